@@ -143,76 +143,120 @@ typedef __uint128_t fixedptud;
 
 #define fixedpt_abs(A) ((A) < 0 ? -(A) : (A))
 
-/* Multiplies two fixedpt numbers, returns the result. */
-static inline fixedpt fixedpt_mul(fixedpt A, fixedpt B) {
-#if FIXEDPT_BITS == 64 && defined(FIXEDPT_NO_SSE)
-  /* A bit complicated but non-SSE version. */
-  int128 tmp;
-  uint64_t a0, a1;
-  uint64_t b0, b1;
-  uint64_t d, d0, d1;
-  uint64_t e, e0, e1;
-  uint64_t f, f0, f1;
-  uint64_t g, g0, g1;
-  uint64_t sum, carry, roll, pmax;
-  fixedpt result;
+/*
+ * 64-bit multiply without a native 128-bit type: the magnitudes are split
+ * into 32-bit limbs and the four partial products are summed with the
+ * carries computed arithmetically, so there are no data dependent branches
+ * (this is what RV32E ends up using). The product is rounded toward zero.
+ */
+#if FIXEDPT_BITS == 64
+/* Full 128-bit product (*hi, *lo) of two unsigned 64-bit limb pairs. */
+static inline void fixedpt_umul_wide(uint64_t ua, uint64_t ub, uint64_t *hi,
+                                     uint64_t *lo) {
+  uint64_t a0 = (uint32_t)ua, a1 = ua >> 32;
+  uint64_t b0 = (uint32_t)ub, b1 = ub >> 32;
+  uint64_t d = a0 * b0, e = a0 * b1, f = a1 * b0, g = a1 * b1;
+  uint64_t mid;
+
+  /* mid < 3 * 2^32, its upper half is the carry into the high word */
+  mid = (d >> 32) + (uint32_t)e + (uint32_t)f;
+  *lo = (mid << 32) | (uint32_t)d;
+  *hi = g + (e >> 32) + (f >> 32) + (mid >> 32);
+}
 
-  tmp.sign = 0;
+static inline fixedpt fixedpt_mul_limb(fixedpt A, fixedpt B) {
+  uint64_t sa = (uint64_t)(A >> 63), sb = (uint64_t)(B >> 63);
+  uint64_t ua = ((uint64_t)A ^ sa) - sa, ub = ((uint64_t)B ^ sb) - sb;
+  uint64_t lo, hi, result, sign;
 
-  if (0 > A) {
-    tmp.sign = !tmp.sign;
-    A = -A;
-  }
+  fixedpt_umul_wide(ua, ub, &hi, &lo);
+  result = (hi << (64 - FIXEDPT_FBITS)) | (lo >> FIXEDPT_FBITS);
+  sign = sa ^ sb;
+  return (fixedpt)((result ^ sign) - sign);
+}
 
-  if (0 > B) {
-    tmp.sign = !tmp.sign;
-    B = -B;
-  }
+#if defined(__SIZEOF_INT128__)
+/* Same rounding as fixedpt_mul_limb(), on hosts with a 128-bit type. */
+static inline fixedpt fixedpt_mul_int128(fixedpt A, fixedpt B) {
+  __int128 p = (__int128)A * B;
+
+  p += (p >> 127) & FIXEDPT_FMASK;
+  return (fixedpt)(p >> FIXEDPT_FBITS);
+}
+#endif
+#endif
 
-  a1 = A >> 32;
-  a0 = A - (a1 << 32);
+/* Multiplies two fixedpt numbers, returns the result. */
+static inline fixedpt fixedpt_mul(fixedpt A, fixedpt B) {
+#if FIXEDPT_BITS == 64 && defined(FIXEDPT_NO_SSE)
+#if defined(__SIZEOF_INT128__)
+  return fixedpt_mul_int128(A, B);
+#else
+  return fixedpt_mul_limb(A, B);
+#endif
+#else
+  return (((fixedptd)A * (fixedptd)B) >> FIXEDPT_FBITS);
+#endif
+}
 
-  b1 = B >> 32;
-  b0 = B - (b1 << 32);
+/*
+ * Double-width accumulator for sums of products. fixedpt_acc_mac() adds the
+ * exact (unshifted) product A * B, and fixedpt_acc_get() shifts the sum back
+ * to a fixedpt once, rounding to nearest. Compared to summing fixedpt_mul()
+ * results this saves the per-product shift and does not drop the fraction
+ * bits of every product.
+ */
+#if FIXEDPT_BITS == 32
+typedef struct {
+  fixedptd v;
+} fixedpt_acc;
 
-  d = a0 * b0;
-  d1 = d >> 32;
-  d0 = d - (d1 << 32);
+static inline void fixedpt_acc_mac(fixedpt_acc *acc, fixedpt A, fixedpt B) {
+  acc->v += (fixedptd)A * B;
+}
 
-  e = a0 * b1;
-  e1 = e >> 32;
-  e0 = e - (e1 << 32);
+static inline fixedpt fixedpt_acc_get(fixedpt_acc acc) {
+  return (fixedpt)((acc.v + FIXEDPT_ONE_HALF) >> FIXEDPT_FBITS);
+}
+#elif defined(__SIZEOF_INT128__)
+typedef struct {
+  __int128 v;
+} fixedpt_acc;
 
-  f = a1 * b0;
-  f1 = f >> 32;
-  f0 = f - (f1 << 32);
+static inline void fixedpt_acc_mac(fixedpt_acc *acc, fixedpt A, fixedpt B) {
+  acc->v += (__int128)A * B;
+}
 
-  g = a1 * b1;
-  g1 = g >> 32;
-  g0 = g - (g1 << 32);
+static inline fixedpt fixedpt_acc_get(fixedpt_acc acc) {
+  return (fixedpt)((acc.v + FIXEDPT_ONE_HALF) >> FIXEDPT_FBITS);
+}
+#else
+typedef struct {
+  uint64_t lo;
+  uint64_t hi; /* two's complement 128-bit value */
+} fixedpt_acc;
 
-  sum = d1 + e0 + f0;
-  carry = 0;
-  roll = 1 << 30;
-  roll <<= 2;
+static inline void fixedpt_acc_mac(fixedpt_acc *acc, fixedpt A, fixedpt B) {
+  uint64_t sa = (uint64_t)(A >> 63), sb = (uint64_t)(B >> 63);
+  uint64_t ua = ((uint64_t)A ^ sa) - sa, ub = ((uint64_t)B ^ sb) - sb;
+  uint64_t lo, hi, sign = sa ^ sb;
 
-  pmax = roll - 1;
-  for (; pmax < sum; sum -= roll, carry++)
-    ;
+  fixedpt_umul_wide(ua, ub, &hi, &lo);
+  /* negate the 128-bit product when the signs differ */
+  lo = (lo ^ sign) - sign;
+  hi = (hi ^ sign) + (sign & (uint64_t)(lo == 0));
 
-  tmp.lo = d0 + (sum << 32);
-  tmp.hi = carry + e1 + f1 + g0 + (g1 << 32);
+  acc->lo += lo;
+  acc->hi += hi + (acc->lo < lo);
+}
 
-  result = ((tmp.hi >> FIXEDPT_FBITS) << (2 * FIXEDPT_FBITS)) +
-           ((tmp.hi & FIXEDPT_FMASK) << FIXEDPT_FBITS) +
-           (tmp.lo >> FIXEDPT_FBITS);
-  result = tmp.sign ? -result : result;
+static inline fixedpt fixedpt_acc_get(fixedpt_acc acc) {
+  uint64_t lo = acc.lo + FIXEDPT_ONE_HALF;
+  uint64_t hi = acc.hi + (lo < (uint64_t)FIXEDPT_ONE_HALF);
 
-  return result;
-#else
-  return (((fixedptd)A * (fixedptd)B) >> FIXEDPT_FBITS);
-#endif
+  return (fixedpt)((hi << (64 - FIXEDPT_FBITS)) | (lo >> FIXEDPT_FBITS));
 }
+#endif
 
 /* Divides two fixedpt numbers, returns the result. */
 static inline fixedpt fixedpt_div(fixedpt A, fixedpt B) {
@@ -3,6 +3,7 @@
 #include <klib.h>
 
 #include "fixedpt.h"
+#include "simd.h"
 
 #define A(i, j) a[(j) * lda + (i)]
 #define B(i, j) b[(j) * ldb + (i)]
@@ -16,13 +17,225 @@
 #define B_col(i, j) b[(j) * ldb + (i)]
 #define C_col(i, j) c[(j) * ldc + (i)]
 
+/*
+ * Register block of the tile kernels: C is computed in GEMM_MR x GEMM_NR
+ * tiles from panels of A packed GEMM_MR rows wide and panels of B packed
+ * GEMM_NR columns wide. The SIMD device kernels only do 4x4, the other
+ * shapes (8x4, 4x8, 8x8) run the AddDot<MR>x<NR>_cpu kernels. Set with
+ * e.g. `make GEMM_MR=8`.
+ */
+#ifndef GEMM_MR
+#define GEMM_MR 4
+#endif
+#ifndef GEMM_NR
+#define GEMM_NR 4
+#endif
+
+/* Packed panels are aligned to this many bytes */
+#define GEMM_CACHE_LINE 64
+
+typedef struct {
+  void *raw;   /* pointer returned by malloc */
+  char *base;  /* raw rounded up to GEMM_CACHE_LINE */
+  size_t size; /* usable bytes starting at base */
+  size_t used; /* bytes handed out since the last reset */
+  size_t peak; /* largest `used` ever seen */
+} matmul_workspace;
+
+matmul_workspace *matmul_workspace_create(size_t bytes);
+void matmul_workspace_destroy(matmul_workspace *ws);
+int matmul_workspace_reserve(matmul_workspace *ws, size_t bytes);
+void matmul_workspace_reset(matmul_workspace *ws);
+void *matmul_workspace_alloc(matmul_workspace *ws, size_t bytes);
+size_t matmul_workspace_peak(const matmul_workspace *ws);
+size_t matmul_workspace_query(int m, int n, int k);
+
 void AddDot4x4(int, fixedpt *, int, fixedpt *, int, fixedpt *, int);
-void PackMatrixA(int, fixedpt *, int, fixedpt *);
-void PackMatrixB(int, fixedpt *, int, fixedpt *);
-void InnerKernel(int, int, int, fixedpt *, int, fixedpt *, int, fixedpt *, int,
-                 int);
+#if GEMM_MR == 4 && GEMM_NR == 4 /* reads 4x4 panels, no other shape */
+void AddDot4x4_wide(int, fixedpt *, int, fixedpt *, int, fixedpt *, int);
+#endif
+void AddDot4x4_cpu(int, fixedpt *, int, fixedpt *, int, fixedpt *, int);
+void AddDot8x4_cpu(int, fixedpt *, int, fixedpt *, int, fixedpt *, int);
+void AddDot4x8_cpu(int, fixedpt *, int, fixedpt *, int, fixedpt *, int);
+void AddDot8x8_cpu(int, fixedpt *, int, fixedpt *, int, fixedpt *, int);
+void AddDot4x4xK(int, fixedpt *, int, fixedpt *, int, fixedpt *, int);
+void AddDot4x4_vregs(int, fixedpt *, int, fixedpt *, int, fixedpt *, int);
+/* Layout, scales and epilogue of one matmul call, see matmul.c */
+typedef struct gemm_call gemm_call;
+
+void AddDot_edge(const gemm_call *, int, int, int, fixedpt *, fixedpt *,
+                 fixedpt, int, fixedpt *, int, int, int);
+int PackMatrixA(int, int, fixedpt *, int, fixedpt *);
+int PackMatrixB(int, int, fixedpt *, int, fixedpt *);
+int PackMatrixA_T(int, int, fixedpt *, int, fixedpt *);
+int PackMatrixB_T(int, int, fixedpt *, int, fixedpt *);
+void InnerKernel(const gemm_call *, int, int, int, fixedpt *, int, fixedpt *,
+                 int, fixedpt *, int, int, int, int, fixedpt, int, fixedpt *,
+                 fixedpt *, unsigned char *, unsigned char *);
+typedef void (*gemm_block_fn)(void *arg, int i, int j, int p, int ib, int jb,
+                              int pb, int first);
+void gemm_blocks(int m, int n, int k, gemm_block_fn fn, void *arg);
 void matmul(int m, int n, int k, fixedpt *a, int lda, fixedpt *b, int ldb,
             fixedpt *c, int ldc);
+void matmul_ws(int m, int n, int k, fixedpt *a, int lda, fixedpt *b, int ldb,
+               fixedpt *c, int ldc, matmul_workspace *ws);
+
+/* Layout flags of matmul_flags() */
+#define GEMM_TRANS_A (1 << 0)   /* A is stored transposed, k x m */
+#define GEMM_TRANS_B (1 << 1)   /* B is stored transposed, n x k */
+#define GEMM_ROW_MAJOR (1 << 2) /* A, B and C are row-major */
+
+void matmul_flags(int flags, int m, int n, int k, fixedpt *a, int lda,
+                  fixedpt *b, int ldb, fixedpt *c, int ldc);
+
+/*
+ * alpha is applied to the product of every kc block and rounds each time,
+ * so the last bits of an alpha != 1 result depend on the kc of gemm_params,
+ * but not on the thread count.
+ */
+void matmul_gemm(int flags, int m, int n, int k, fixedpt alpha, fixedpt *a,
+                 int lda, fixedpt *b, int ldb, fixedpt beta, fixedpt *c,
+                 int ldc);
+
+/* Epilogue of matmul_gemm_ep(), applied to C in this order */
+#define GEMM_ACT_NONE 0
+#define GEMM_ACT_RELU 1 /* max(C, 0) */
+
+typedef struct {
+  const fixedpt *bias; /* bias[j] added to column j of C, or NULL */
+  int act;             /* GEMM_ACT_NONE or GEMM_ACT_RELU */
+  int clamp;           /* saturate C to [lo, hi] */
+  fixedpt lo, hi;
+} gemm_epilogue;
+
+void matmul_gemm_ep(int flags, int m, int n, int k, fixedpt alpha,
+                    fixedpt *a, int lda, fixedpt *b, int ldb, fixedpt beta,
+                    fixedpt *c, int ldc, const gemm_epilogue *ep);
+
+/* B packed once for many products, see matmul_pack_b() */
+typedef struct matmul_packed_b matmul_packed_b;
+
+matmul_packed_b *matmul_pack_b(int k, int n, fixedpt *b, int ldb);
+void matmul_packed_b_free(matmul_packed_b *bp);
+size_t matmul_packed_b_size(const matmul_packed_b *bp);
+size_t matmul_packed_b_save(const matmul_packed_b *bp, void *buf, size_t len);
+matmul_packed_b *matmul_packed_b_load(const void *buf, size_t len);
+void matmul_prepacked(int m, int n, int k, fixedpt *a, int lda,
+                      const matmul_packed_b *bp, fixedpt *c, int ldc);
+void matmul_batched(int count, int m, int n, int k, fixedpt *a, int lda,
+                    int stride_a, fixedpt *b, int ldb, int stride_b,
+                    fixedpt *c, int ldc, int stride_c);
+void matmul_batched_ptr(int count, int m, int n, int k, fixedpt **a, int lda,
+                        fixedpt **b, int ldb, fixedpt **c, int ldc);
+
+/*
+ * The same GEMM for 24.8 in 32 bits (src/matmul_q24_8.c), which is in every
+ * build whatever FIXEDPT_BITS is, and for 56.8 in 64 bits. The latter is
+ * matmul() itself under another name, so it only exists when fixedpt is
+ * 56.8, which is the default.
+ */
+typedef int32_t fixedpt_q24_8;
+typedef int64_t fixedpt_q56_8;
+
+void matmul_q24_8(int m, int n, int k, const fixedpt_q24_8 *a, int lda,
+                  const fixedpt_q24_8 *b, int ldb, fixedpt_q24_8 *c, int ldc);
+#if FIXEDPT_BITS == 64 && FIXEDPT_FBITS == 8
+void matmul_q56_8(int m, int n, int k, fixedpt_q56_8 *a, int lda,
+                  fixedpt_q56_8 *b, int ldb, fixedpt_q56_8 *c, int ldc);
+#endif
+
+/*
+ * Quantized operand of matmul_quant(): element (i, j) stands for the real
+ * value scale * (q(i, j) - zero). The scales have GEMM_QSCALE_FBITS
+ * fraction bits. B may have a scale and zero point per column.
+ */
+#define GEMM_QINT8 1  /* int8_t elements, int32 sums */
+#define GEMM_QINT16 2 /* int16_t elements, int64 sums */
+#define GEMM_QSCALE_FBITS 16
+
+typedef struct {
+  int type;             /* GEMM_QINT8 or GEMM_QINT16 */
+  const void *data;     /* column-major */
+  int ld;               /* leading dimension, in elements */
+  const int32_t *scale; /* scale[0], or scale[j] with per_column */
+  const int32_t *zero;  /* zero[0], or zero[j] with per_column */
+  int per_column;
+} gemm_qmatrix;
+
+void matmul_quant(int m, int n, int k, const gemm_qmatrix *a,
+                  const gemm_qmatrix *b, fixedpt *c, int ldc);
+
+/*
+ * Sparse A of matmul_sparse(), see src/sparse.c. CSR keeps every nonzero
+ * element, BSR every GEMM_MR x GEMM_SPARSE_BK block with a nonzero, whose
+ * values are stored like a packed A panel so the tile kernel reads them
+ * directly. The last blocks of a row or column are zero padded.
+ */
+#define GEMM_SPARSE_CSR 0
+#define GEMM_SPARSE_BSR 1
+#define GEMM_SPARSE_BK 4 /* depth of a BSR block */
+
+typedef struct {
+  int format; /* GEMM_SPARSE_CSR or GEMM_SPARSE_BSR */
+  int m, k;
+  int rows;     /* m, or the GEMM_MR high block rows for BSR */
+  int *ptr;     /* entries of row r are ptr[r] .. ptr[r + 1] - 1 */
+  int *idx;     /* column, or block column, of every entry, ascending */
+  fixedpt *val; /* one value, or GEMM_MR * GEMM_SPARSE_BK, per entry */
+} gemm_sparse;
+
+gemm_sparse *gemm_sparse_from_dense(int format, int m, int k, fixedpt *a,
+                                    int lda);
+void gemm_sparse_free(gemm_sparse *sp);
+void matmul_sparse(int m, int n, int k, const gemm_sparse *a, fixedpt *b,
+                   int ldb, fixedpt *c, int ldc);
+size_t matmul_strassen_query(int n);
+uint64_t matmul_strassen(int n, fixedpt *a, int lda, fixedpt *b, int ldb,
+                         fixedpt *c, int ldc, matmul_workspace *ws);
+void matmul_row(int m, int n, int k, fixedpt *a, int lda, fixedpt *b, int ldb,
+                fixedpt *c, int ldc);
+void matmul_col(int m, int n, int k, fixedpt *a, int lda, fixedpt *b, int ldb,
+                fixedpt *c, int ldc);
+void matmul_baseline(int m, int n, int k, fixedpt *a, int lda, fixedpt *b,
+                     int ldb, fixedpt *c, int ldc);
+
+/*
+ * Block sizes and tile kernel of matmul(), the size of the operands it
+ * multiplies without packing and the rows of C its matrix times vector
+ * product keeps in the cache, and the size below which matmul_strassen()
+ * stops recursing, settable at runtime. They start from the GEMM_PROFILE
+ * string of include/gemm_profile.h when `just tune` has written one, else
+ * from the defaults below. See src/tune.c.
+ */
+#define GEMM_DEFAULT_MC 256
+#define GEMM_DEFAULT_KC 128
+#define GEMM_DEFAULT_NC 1000
+#define GEMM_DEFAULT_STRASSEN 128
+#define GEMM_DEFAULT_DIRECT 16
+#define GEMM_DEFAULT_GEMV 512
+
+typedef struct {
+  int mc, kc, nc;     /* rows of A, depth and columns of B per block */
+  const char *kernel; /* tile kernel, NULL picks one from SIMD_CAP */
+  int strassen;       /* cutoff of matmul_strassen() */
+  int direct;         /* KiB of A, B and C read in place, 0 packs all */
+  int gemv;           /* rows of C per pass over A when n is 1 */
+} gemm_params;
+
+void gemm_get_params(gemm_params *p);
+int gemm_set_params(const gemm_params *p);
+const char *gemm_kernel_name(int i);
+int gemm_parse_params(const char *profile, gemm_params *p);
+void gemm_tune(int size, gemm_params *best);
+
+/* Threads, see src/thread.c */
+#define GEMM_MAX_THREADS 16
+
+void gemm_threads_start(void (*app)(void));
+int gemm_threads(void);
+void gemm_set_threads(int n);
+void gemm_parallel(void (*fn)(int, int, void *), void *arg);
+void gemm_barrier(void);
 
 void serial_init(int m, int n, fixedpt *a, int lda, int type);
 void random_init(int m, int n, fixedpt *a, int lda, int type);
@@ -0,0 +1,173 @@
+#ifndef _SIMD_H_
+#define _SIMD_H_
+
+#include <stdint.h>
+
+#include "fixedpt.h"
+
+/*
+ * Driver interface of the virtual SIMD device, see Virtual-SIMD-Spec.md.
+ *
+ * The original instructions (simd_setzero, simd_load, simd_loaddup,
+ * simd_mul_add) are single writes of an instruction word to SIMD_CMD and
+ * are provided by abstract-machine. Extended commands take full-width
+ * operands from the argument registers, which are written first, and are
+ * only issued when the device advertises them in SIMD_CAP.
+ */
+
+#define SIMD_MMIO 0xa2000000
+#define SIMD_CMD (SIMD_MMIO + 0x00)            /* W: instruction word */
+#define SIMD_CAP (SIMD_MMIO + 0x04)            /* R: capability bits */
+#define SIMD_ARG(n) (SIMD_MMIO + 0x08 + 4 * (n)) /* W: argument registers */
+#define SIMD_NR_ARGS 6
+#define SIMD_RING_BASE (SIMD_MMIO + 0x20) /* W: descriptor ring address */
+#define SIMD_RING_SIZE (SIMD_MMIO + 0x24) /* W: ring entries, power of 2 */
+#define SIMD_RING_TAIL (SIMD_MMIO + 0x28) /* W: doorbell, producer index */
+#define SIMD_RING_HEAD (SIMD_MMIO + 0x2c) /* R: consumer index */
+
+/*
+ * Operands field [31, 24] of extended commands. For the register file
+ * instructions bits [29, 28] give the vector length (SIMD_VL), and lane i
+ * of a memory operand `mem` is:
+ *   VLOAD    mem[i]
+ *   VLOADDUP mem[i / 4] (mem[0] for 2-lane vectors)
+ *   VLOADREP mem[i % 4]
+ */
+#define SIMD_OP_DOT4X4XK 0x80
+#define SIMD_OP_VZERO 0x81    /* v[dst] = 0 */
+#define SIMD_OP_VLOAD 0x82    /* v[dst] = mem[ARG(src2) + src1] */
+#define SIMD_OP_VLOADDUP 0x83 /* v[dst] = dup(mem[ARG(src2) + src1]) */
+#define SIMD_OP_VMLA 0x84     /* v[dst] += v[src1] * v[src2] */
+#define SIMD_OP_VSTORE 0x85   /* mem[ARG(src2) + src1] = v[dst] */
+#define SIMD_OP_VLOADREP 0x86 /* v[dst] = rep(mem[ARG(src2) + src1]) */
+#define SIMD_OP_SETARG 0x87   /* ARG(dst) = data, ring descriptors only */
+#define SIMD_OP_QDOT4X4XK 0x88
+
+#define SIMD_INSN(op, dst, src2, src1)                                        \
+  (((uint32_t)(op) << 24) | ((uint32_t)(dst) << 16) |                          \
+   ((uint32_t)(src2) << 8) | (uint32_t)(src1))
+
+/* SIMD_CAP bits */
+#define SIMD_CAP_DOT4X4XK (1u << 0)
+#define SIMD_CAP_VREGS (1u << 1)
+#define SIMD_CAP_VL4 (1u << 2)
+#define SIMD_CAP_VL8 (1u << 3)
+#define SIMD_CAP_RING (1u << 4)
+#define SIMD_CAP_QDOT4X4XK (1u << 5)
+
+/*
+ * Register file of SIMD_CAP_VREGS devices: 16 vectors of up to 8 fixedpt
+ * lanes. SIMD_LANES picks the vector length the driver and the kernels are
+ * built for (2, 4 or 8), wider vectors need SIMD_CAP_VL4 / SIMD_CAP_VL8.
+ */
+#define SIMD_NR_VREGS 16
+#define SIMD_MAX_LANES 8
+
+#ifndef SIMD_LANES
+#define SIMD_LANES 2
+#endif
+
+#if SIMD_LANES == 2
+#define SIMD_VL 0x00
+#define SIMD_CAP_VLANES SIMD_CAP_VREGS
+#elif SIMD_LANES == 4
+#define SIMD_VL 0x10
+#define SIMD_CAP_VLANES (SIMD_CAP_VREGS | SIMD_CAP_VL4)
+#elif SIMD_LANES == 8
+#define SIMD_VL 0x20
+#define SIMD_CAP_VLANES (SIMD_CAP_VREGS | SIMD_CAP_VL8)
+#else
+#error "SIMD_LANES must be 2, 4 or 8"
+#endif
+
+#ifdef __ISA_NATIVE__
+/*
+ * On native the bus accesses, and the original instructions that
+ * abstract-machine provides on the real target, go to the software model
+ * in src/simd.c.
+ */
+void simd_outl(uintptr_t addr, uintptr_t data);
+uintptr_t simd_inl(uintptr_t addr);
+void simd_setzero(uintptr_t dst1, uintptr_t dst2, uintptr_t dst3);
+void simd_load(uintptr_t dst, uintptr_t src);
+void simd_loaddup(uintptr_t dst, uintptr_t src);
+void simd_mul_add(uintptr_t dst, uintptr_t src2, uintptr_t src1);
+void simd_model_report(void);
+#else
+static inline void simd_outl(uintptr_t addr, uintptr_t data) {
+  *(volatile uint32_t *)addr = data;
+}
+static inline uintptr_t simd_inl(uintptr_t addr) {
+  return *(volatile uint32_t *)addr;
+}
+#endif
+
+/*
+ * Descriptor ring of SIMD_CAP_RING devices. While the ring is enabled the
+ * driver appends instructions to it instead of writing SIMD_CMD, and the
+ * device only sees them after simd_ring_submit() rings the doorbell.
+ * Results in memory are only valid once simd_ring_wait() on the fence
+ * returned by the submit (or simd_ring_fence()) has returned.
+ */
+typedef struct {
+  uint32_t insn;
+  uintptr_t data; /* value of SIMD_OP_SETARG */
+} simd_desc;
+
+#define SIMD_RING_ENTRIES 256
+
+extern int simd_ring_on;
+
+void simd_ring_enable(void);
+void simd_ring_disable(void);
+void simd_ring_push(uint32_t insn, uintptr_t data);
+uint32_t simd_ring_submit(void);
+void simd_ring_wait(uint32_t fence);
+void simd_ring_fence(void);
+
+static inline void simd_cmd(uint32_t insn) {
+  if (simd_ring_on)
+    simd_ring_push(insn, 0);
+  else
+    simd_outl(SIMD_CMD, insn);
+}
+static inline void simd_arg(int n, uintptr_t data) {
+  if (simd_ring_on)
+    simd_ring_push(SIMD_INSN(SIMD_OP_SETARG, n, 0, 0), data);
+  else
+    simd_outl(SIMD_ARG(n), data);
+}
+
+int simd_has(uint32_t cap);
+void simd_dot4x4xk(fixedpt *a, fixedpt *b, int k, fixedpt *c, int ldc);
+void simd_qdot4x4xk(const int8_t *a, const int8_t *b, int k, int32_t *c,
+                    int ldc);
+
+/*
+ * Register file instructions. Memory operands are addressed as a base
+ * pointer held in argument register `base` plus an offset of `off` (< 256)
+ * fixedpt elements, so only the base needs a full-width write.
+ */
+static inline void simd_setbase(int base, const fixedpt *p) {
+  simd_arg(base, (uintptr_t)p);
+}
+static inline void simd_vzero(int vd) {
+  simd_cmd(SIMD_INSN(SIMD_OP_VZERO | SIMD_VL, vd, 0, 0));
+}
+static inline void simd_vload(int vd, int base, int off) {
+  simd_cmd(SIMD_INSN(SIMD_OP_VLOAD | SIMD_VL, vd, base, off));
+}
+static inline void simd_vloaddup(int vd, int base, int off) {
+  simd_cmd(SIMD_INSN(SIMD_OP_VLOADDUP | SIMD_VL, vd, base, off));
+}
+static inline void simd_vloadrep(int vd, int base, int off) {
+  simd_cmd(SIMD_INSN(SIMD_OP_VLOADREP | SIMD_VL, vd, base, off));
+}
+static inline void simd_vmla(int vd, int va, int vb) {
+  simd_cmd(SIMD_INSN(SIMD_OP_VMLA | SIMD_VL, vd, vb, va));
+}
+static inline void simd_vstore(int vs, int base, int off) {
+  simd_cmd(SIMD_INSN(SIMD_OP_VSTORE | SIMD_VL, vs, base, off));
+}
+
+#endif
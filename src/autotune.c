@@ -0,0 +1,30 @@
+#include <gemm.h>
+
+/*
+ * Tuning mode: runs gemm_tune() and prints the fastest parameters as the
+ * GEMM_PROFILE line of include/gemm_profile.h, which `just tune` saves.
+ * mainargs="size=<n>" sets the problem size that is timed.
+ */
+
+int main(const char *args) {
+  gemm_params best;
+  int size = 128;
+
+  ioe_init();
+  if (args != NULL && strncmp(args, "size=", 5) == 0)
+    size = atoi(args + 5);
+  if (size < 4)
+    size = 4;
+
+  uint64_t start = io_read(AM_TIMER_UPTIME).us;
+  gemm_tune(size, &best);
+  uint64_t us = io_read(AM_TIMER_UPTIME).us - start;
+
+  printf("/* Tuned on %dx%dx%d in %d ms */\n", size, size, size,
+         (int)(us / 1000));
+  printf("#define GEMM_PROFILE \"mc=%d kc=%d nc=%d kernel=%s strassen=%d "
+         "direct=%d gemv=%d\"\n",
+         best.mc, best.kc, best.nc, best.kernel ? best.kernel : "auto",
+         best.strassen, best.direct, best.gemv);
+  return 0;
+}
@@ -4,8 +4,8 @@
 #define B(i, j) b[(j) * ldb + (i)]
 #define C(i, j) c[(j) * ldc + (i)]
 
-void AddDot4x4(int k, fixedpt *a, int lda, fixedpt *b, int ldb, fixedpt *c,
-               int ldc) {
+static void AddDot4x4_baseline(int k, fixedpt *a, int lda, fixedpt *b,
+                               int ldb, fixedpt *c, int ldc) {
 
   register fixedpt c_00, c_01, c_02, c_03, c_10, c_11, c_12, c_13, c_20, c_21,
       c_22, c_23, c_30, c_31, c_32, c_33, a_0p, a_1p, a_2p, a_3p, b_0p_reg,
@@ -109,10 +109,11 @@ void AddDot4x4(int k, fixedpt *a, int lda, fixedpt *b, int ldb, fixedpt *c,
   C(3, 3) = fixedpt_add(C(3, 3), c_33);
 }
 
-void matmul(int m, int n, int k, fixedpt *a, int lda, fixedpt *b, int ldb,
-            fixedpt *c, int ldc) {
+void matmul_baseline(int m, int n, int k, fixedpt *a, int lda, fixedpt *b,
+                     int ldb, fixedpt *c, int ldc) {
   /*
-  Computes the matrix multiplication of A and B and stores in C.
+  Computes the matrix multiplication of A and B and stores in C with the
+  unpacked 4x4 register kernel. m and n must be multiples of 4.
   C = A*B + C
   Arguments
   ---------
@@ -137,37 +138,8 @@ void matmul(int m, int n, int k, fixedpt *a, int lda, fixedpt *b, int ldb,
   // #pragma omp parallel for num_threads(4)
   for (int j = 0; j < n; j += 4) {   // Loop over the columns of C with stride 4
     for (int i = 0; i < m; i += 4) { // Loop over the rows of C
-      AddDot4x4(k, &A(i, 0), lda, &B(0, j), ldb, &C(i, j), ldc);
+      AddDot4x4_baseline(k, &A(i, 0), lda, &B(0, j), ldb, &C(i, j), ldc);
     }
   }
   return;
 }
-
-int main() {
-
-  int m = 20;
-  int n = 20;
-  int k = 20;
-
-  fixedpt *A = (fixedpt *)malloc(m * k * sizeof(fixedpt));
-  fixedpt *B = (fixedpt *)malloc(k * n * sizeof(fixedpt));
-  fixedpt *C = (fixedpt *)malloc(m * n * sizeof(fixedpt));
-
-  random_init_notype(m, k, A, m);
-  random_init_notype(k, n, B, k);
-
-  matmul(m, n, k, A, m, B, k, C, m);
-
-  if (m <= 8) {
-    printf("Matrix A : \n");
-    display_notype(A, m, k);
-
-    printf("Matrix B : \n");
-    display_notype(B, k, n);
-
-    printf("Dot Product Result : \n");
-    display_notype(C, m, n);
-  }
-
-  return 0;
-}
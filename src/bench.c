@@ -0,0 +1,337 @@
+#include <gemm.h>
+
+/*
+ * Benchmark driver: sweeps square problem sizes and times every matmul
+ * implementation on the same inputs. One CSV row is printed per run:
+ *
+ *   impl,m,n,k,us,kmacs_per_s,est_mmacs_per_cycle,checksum
+ *
+ * est_mmacs_per_cycle is an estimate in thousandths of a MAC per cycle: the
+ * wall time is converted to cycles at the assumed clock BENCH_CPU_MHZ, not
+ * read from a cycle counter. checksum folds all of C so that runs can be
+ * compared across releases.
+ *
+ * The sweep is set with mainargs, e.g. mainargs="lo=16 hi=128 step=16",
+ * k=<n> (n=<n>) fixes k (n) instead of following the size, e.g. n=1 for
+ * matrix times vector products, and reps=<n> repeats every run and keeps
+ * the fastest. threads=<n> limits matmul to n CPUs, the default being
+ * every CPU the machine has, and mc=, kc=, nc=, kernel=, direct= and gemv=
+ * set the parameters of matmul (see gemm_parse_params()).
+ *
+ * matmul_strassen only runs with k = m = n, and a comment row after every
+ * size gives the share of the fixedpt products it saved.
+ *
+ * batch=<count> also times count independent problems of every size, once
+ * through a loop of matmul calls and once through matmul_batched, and
+ * prints them as
+ *
+ *   impl,count,m,n,k,us,matrices_per_s,checksum
+ *
+ * sparse=1 also prunes A of every size to a range of densities, in blocks
+ * of GEMM_MR x GEMM_SPARSE_BK, and times matmul against matmul_sparse with
+ * A in CSR and in BSR, to find where the sparse formats start to pay off:
+ *
+ *   impl,density,m,n,k,us,checksum
+ */
+
+#ifndef BENCH_CPU_MHZ
+#define BENCH_CPU_MHZ 100
+#endif
+
+typedef void (*matmul_fn)(int, int, int, fixedpt *, int, fixedpt *, int,
+                          fixedpt *, int);
+
+/* B of the current size, packed once outside of the timed runs */
+static matmul_packed_b *packed_b;
+
+static void prepacked(int m, int n, int k, fixedpt *a, int lda, fixedpt *b,
+                      int ldb, fixedpt *c, int ldc) {
+  matmul_prepacked(m, n, k, a, lda, packed_b, c, ldc);
+}
+
+/* fixedpt products of the last matmul_strassen run */
+static uint64_t strassen_muls;
+
+static void strassen(int m, int n, int k, fixedpt *a, int lda, fixedpt *b,
+                     int ldb, fixedpt *c, int ldc) {
+  strassen_muls = matmul_strassen(n, a, lda, b, ldb, c, ldc, NULL);
+}
+
+/* A and B of the current size narrowed to 24.8, also outside of the runs */
+static fixedpt_q24_8 *a32, *b32, *c32;
+
+static void q24_8(int m, int n, int k, fixedpt *a, int lda, fixedpt *b,
+                  int ldb, fixedpt *c, int ldc) {
+  /* C is converted both ways so that the checksum covers the same values */
+  int i, j;
+
+  for (j = 0; j < n; j++)
+    for (i = 0; i < m; i++)
+      c32[j * ldc + i] = (fixedpt_q24_8)C(i, j);
+  matmul_q24_8(m, n, k, a32, lda, b32, ldb, c32, ldc);
+  for (j = 0; j < n; j++)
+    for (i = 0; i < m; i++)
+      C(i, j) = c32[j * ldc + i];
+}
+
+static struct {
+  const char *name;
+  matmul_fn fn;
+  int multiple_of_4; /* needs m and n divisible by 4 */
+} impls[] = {
+    {"matmul_row", matmul_row, 0},
+    {"matmul_col", matmul_col, 0},
+    {"matmul_baseline", matmul_baseline, 1},
+    {"matmul", matmul, 0},
+    {"matmul_prepacked", prepacked, 0},
+    {"matmul_q24_8", q24_8, 0},
+    {"matmul_strassen", strassen, 0},
+};
+
+static int lo = 16, hi = 64, step = 16, fixed_k = 0, fixed_n = 0, reps = 1;
+static int threads = 0;
+static int batch = 0, sparse = 0;
+static const char *mainargs;
+
+static void parse_args(const char *args) {
+  /* args is a space separated list of key=value */
+  while (args != NULL && *args != '\0') {
+    while (*args == ' ')
+      args++;
+    const char *eq = strchr(args, '=');
+    if (eq == NULL)
+      break;
+    int value = atoi(eq + 1);
+
+    if (strncmp(args, "lo=", 3) == 0)
+      lo = value;
+    else if (strncmp(args, "hi=", 3) == 0)
+      hi = value;
+    else if (strncmp(args, "step=", 5) == 0)
+      step = value;
+    else if (strncmp(args, "k=", 2) == 0)
+      fixed_k = value;
+    else if (strncmp(args, "n=", 2) == 0)
+      fixed_n = value;
+    else if (strncmp(args, "reps=", 5) == 0)
+      reps = value;
+    else if (strncmp(args, "threads=", 8) == 0)
+      threads = value;
+    else if (strncmp(args, "batch=", 6) == 0)
+      batch = value;
+    else if (strncmp(args, "sparse=", 7) == 0)
+      sparse = value;
+
+    args = strchr(eq, ' ');
+  }
+  if (step < 1)
+    step = 1;
+  if (reps < 1)
+    reps = 1;
+}
+
+static uint32_t checksum(fixedpt *c, int count) {
+  uint32_t sum = 0;
+  for (int i = 0; i < count; i++)
+    sum = sum * 31 + (uint32_t)c[i] + (uint32_t)((uint64_t)c[i] >> 32);
+  return sum;
+}
+
+static void run(int idx, int m, int n, int k, fixedpt *a, fixedpt *b,
+                fixedpt *c) {
+  uint64_t best = 0;
+
+  for (int r = 0; r < reps; r++) {
+    memset(c, 0, (size_t)m * n * sizeof(fixedpt));
+    uint64_t start = io_read(AM_TIMER_UPTIME).us;
+    impls[idx].fn(m, n, k, a, m, b, k, c, m);
+    uint64_t us = io_read(AM_TIMER_UPTIME).us - start;
+    if (r == 0 || us < best)
+      best = us;
+  }
+
+  uint64_t macs = (uint64_t)m * n * k;
+  uint64_t us = best ? best : 1;
+  printf("%s,%d,%d,%d,%d,%d,%d,%x\n", impls[idx].name, m, n, k, (int)us,
+         (int)(macs * 1000 / us), (int)(macs * 1000 / (us * BENCH_CPU_MHZ)),
+         checksum(c, m * n));
+}
+
+static void run_batch(int m, int n, int k) {
+  size_t sa = (size_t)m * k, sb = (size_t)k * n, sc = (size_t)m * n;
+  fixedpt *A = (fixedpt *)malloc(sa * batch * sizeof(fixedpt));
+  fixedpt *B = (fixedpt *)malloc(sb * batch * sizeof(fixedpt));
+  fixedpt *C = (fixedpt *)malloc(sc * batch * sizeof(fixedpt));
+
+  if (A == NULL || B == NULL || C == NULL) {
+    printf("Allocation Error : batch of %d does not fit in the heap\n", batch);
+    free(A);
+    free(B);
+    free(C);
+    return;
+  }
+  random_init_notype(m, k * batch, A, m);
+  random_init_notype(k, n * batch, B, k);
+
+  for (int batched = 0; batched < 2; batched++) {
+    uint64_t best = 0;
+    for (int r = 0; r < reps; r++) {
+      memset(C, 0, sc * batch * sizeof(fixedpt));
+      uint64_t start = io_read(AM_TIMER_UPTIME).us;
+      if (batched)
+        matmul_batched(batch, m, n, k, A, m, sa, B, k, sb, C, m, sc);
+      else
+        for (int i = 0; i < batch; i++)
+          matmul(m, n, k, A + i * sa, m, B + i * sb, k, C + i * sc, m);
+      uint64_t us = io_read(AM_TIMER_UPTIME).us - start;
+      if (r == 0 || us < best)
+        best = us;
+    }
+    uint64_t us = best ? best : 1;
+    printf("%s,%d,%d,%d,%d,%d,%d,%x\n",
+           batched ? "matmul_batched" : "matmul_loop", batch, m, n, k, (int)us,
+           (int)((uint64_t)batch * 1000000 / us), checksum(C, sc * batch));
+  }
+
+  free(A);
+  free(B);
+  free(C);
+}
+
+/* Percent of the blocks of A kept by the sparse runs */
+static const int densities[] = {1, 5, 10, 20, 30, 50, 70, 100};
+
+static void run_sparse(int m, int n, int k, fixedpt *a, fixedpt *b,
+                       fixedpt *c) {
+  /* a is pruned in place */
+  static const char *names[] = {"matmul", "matmul_csr", "matmul_bsr"};
+  int bk = GEMM_SPARSE_BK;
+
+  for (int d = 0; d < (int)LENGTH(densities); d++) {
+    srand(m * 100 + densities[d]);
+    random_init_notype(m, k, a, m);
+    for (int q = 0; q < k; q += bk)
+      for (int r = 0; r < m; r += GEMM_MR)
+        if (rand() % 100 >= densities[d])
+          for (int j = q; j < k && j < q + bk; j++)
+            for (int i = r; i < m && i < r + GEMM_MR; i++)
+              a[j * m + i] = 0;
+
+    for (int impl = 0; impl < 3; impl++) {
+      gemm_sparse *sp = NULL;
+      uint64_t best = 0;
+
+      if (impl > 0) {
+        sp = gemm_sparse_from_dense(
+            impl == 1 ? GEMM_SPARSE_CSR : GEMM_SPARSE_BSR, m, k, a, m);
+        if (sp == NULL)
+          continue;
+      }
+      for (int r = 0; r < reps; r++) {
+        memset(c, 0, (size_t)m * n * sizeof(fixedpt));
+        uint64_t start = io_read(AM_TIMER_UPTIME).us;
+        if (sp)
+          matmul_sparse(m, n, k, sp, b, k, c, m);
+        else
+          matmul(m, n, k, a, m, b, k, c, m);
+        uint64_t us = io_read(AM_TIMER_UPTIME).us - start;
+        if (r == 0 || us < best)
+          best = us;
+      }
+      printf("%s,%d,%d,%d,%d,%d,%x\n", names[impl], densities[d], m, n, k,
+             (int)(best ? best : 1), checksum(c, m * n));
+      gemm_sparse_free(sp);
+    }
+  }
+}
+
+static void bench(void) {
+  gemm_params params;
+
+  parse_args(mainargs);
+  if (threads > 0)
+    gemm_set_threads(threads);
+  gemm_get_params(&params);
+  if (gemm_parse_params(mainargs, &params))
+    gemm_set_params(&params);
+  gemm_get_params(&params);
+
+  int kmax = fixed_k ? fixed_k : hi, nmax = fixed_n > hi ? fixed_n : hi;
+  fixedpt *A = (fixedpt *)malloc((size_t)hi * kmax * sizeof(fixedpt));
+  fixedpt *B = (fixedpt *)malloc((size_t)kmax * nmax * sizeof(fixedpt));
+  fixedpt *C = (fixedpt *)malloc((size_t)hi * nmax * sizeof(fixedpt));
+
+  a32 = (fixedpt_q24_8 *)malloc((size_t)hi * kmax * sizeof(fixedpt_q24_8));
+  b32 = (fixedpt_q24_8 *)malloc((size_t)kmax * nmax * sizeof(fixedpt_q24_8));
+  c32 = (fixedpt_q24_8 *)malloc((size_t)hi * nmax * sizeof(fixedpt_q24_8));
+  if (A == NULL || B == NULL || C == NULL || a32 == NULL || b32 == NULL ||
+      c32 == NULL) {
+    printf("Allocation Error : benchmark matrices do not fit in the heap\n");
+    return;
+  }
+
+  printf("# threads=%d tile=%dx%d mc=%d kc=%d nc=%d kernel=%s strassen=%d "
+         "direct=%d gemv=%d\n",
+         gemm_threads(), GEMM_MR, GEMM_NR, params.mc, params.kc, params.nc,
+         params.kernel ? params.kernel : "auto", params.strassen,
+         params.direct, params.gemv);
+  printf("impl,m,n,k,us,kmacs_per_s,est_mmacs_per_cycle,checksum\n");
+  for (int size = lo; size <= hi; size += step) {
+    int k = fixed_k ? fixed_k : size, n = fixed_n ? fixed_n : size;
+
+    srand(size);
+    random_init_notype(size, k, A, size);
+    random_init_notype(k, n, B, k);
+    packed_b = matmul_pack_b(k, n, B, k);
+    for (int i = 0; i < size * k; i++)
+      a32[i] = (fixedpt_q24_8)A[i];
+    for (int i = 0; i < k * n; i++)
+      b32[i] = (fixedpt_q24_8)B[i];
+
+    for (int idx = 0; idx < (int)LENGTH(impls); idx++) {
+      if (impls[idx].multiple_of_4 && (size % 4 != 0 || n % 4 != 0))
+        continue;
+      if (impls[idx].fn == prepacked && packed_b == NULL)
+        continue;
+      if (impls[idx].fn == strassen && (k != size || n != size))
+        continue;
+      run(idx, size, n, k, A, B, C);
+    }
+    if (k == size && n == size)
+      printf("# matmul_strassen,%d saved %d%% of %d products\n", size,
+             (int)(100 - strassen_muls * 100 / ((uint64_t)size * size * size)),
+             (int)((uint64_t)size * size * size));
+    matmul_packed_b_free(packed_b);
+  }
+
+  if (batch > 0) {
+    printf("impl,count,m,n,k,us,matrices_per_s,checksum\n");
+    for (int size = lo; size <= hi; size += step)
+      run_batch(size, size, fixed_k ? fixed_k : size);
+  }
+
+  if (sparse) {
+    printf("impl,density,m,n,k,us,checksum\n");
+    for (int size = lo; size <= hi; size += step) {
+      int k = fixed_k ? fixed_k : size;
+
+      srand(size);
+      random_init_notype(k, size, B, k);
+      run_sparse(size, size, k, A, B, C);
+    }
+  }
+
+  free(A);
+  free(B);
+  free(C);
+  free(a32);
+  free(b32);
+  free(c32);
+}
+
+int main(const char *args) {
+  ioe_init();
+  mainargs = args;
+  gemm_threads_start(bench);
+  return 0;
+}
@@ -0,0 +1,118 @@
+#include <gemm.h>
+
+/*
+ * Micro-benchmark for the fixedpt_mul variants in fixedpt.h, plus the
+ * original carry-loop implementation for comparison. Every variant runs the
+ * same operand stream and the results are checked against each other.
+ *
+ * Cycles are derived from the AM timer, so set BENCH_CPU_MHZ to the clock of
+ * the core the benchmark runs on.
+ */
+
+#ifndef BENCH_CPU_MHZ
+#define BENCH_CPU_MHZ 100
+#endif
+
+#define N_OPERANDS 256
+#define N_ROUNDS 2000
+
+/* The fixedpt_mul from upstream fixedptc, kept only as a baseline */
+static fixedpt fixedpt_mul_carryloop(fixedpt A, fixedpt B) {
+  uint64_t a0, a1, b0, b1, d, d0, d1, e, e0, e1, f, f0, f1, g, g0, g1;
+  uint64_t lo, hi, sum, carry, roll, pmax;
+  int sign = 0;
+  fixedpt result;
+
+  if (0 > A) {
+    sign = !sign;
+    A = -A;
+  }
+  if (0 > B) {
+    sign = !sign;
+    B = -B;
+  }
+
+  a1 = A >> 32;
+  a0 = A - (a1 << 32);
+  b1 = B >> 32;
+  b0 = B - (b1 << 32);
+
+  d = a0 * b0;
+  d1 = d >> 32;
+  d0 = d - (d1 << 32);
+  e = a0 * b1;
+  e1 = e >> 32;
+  e0 = e - (e1 << 32);
+  f = a1 * b0;
+  f1 = f >> 32;
+  f0 = f - (f1 << 32);
+  g = a1 * b1;
+  g1 = g >> 32;
+  g0 = g - (g1 << 32);
+
+  sum = d1 + e0 + f0;
+  carry = 0;
+  roll = 1ULL << 32;
+  pmax = roll - 1;
+  for (; pmax < sum; sum -= roll, carry++)
+    ;
+
+  lo = d0 + (sum << 32);
+  hi = carry + e1 + f1 + g0 + (g1 << 32);
+
+  result = ((hi >> FIXEDPT_FBITS) << (2 * FIXEDPT_FBITS)) +
+           ((hi & FIXEDPT_FMASK) << FIXEDPT_FBITS) + (lo >> FIXEDPT_FBITS);
+  return sign ? -result : result;
+}
+
+typedef fixedpt (*mul_fn)(fixedpt, fixedpt);
+
+static fixedpt operands[N_OPERANDS];
+
+static uint32_t lcg_state = 12345;
+static uint32_t lcg() {
+  lcg_state = lcg_state * 1103515245u + 12345u;
+  return lcg_state;
+}
+
+static fixedpt run(mul_fn mul) {
+  fixedpt acc = 0;
+  for (int r = 0; r < N_ROUNDS; r++)
+    for (int i = 0; i < N_OPERANDS; i++)
+      acc += mul(operands[i], operands[(i + r) % N_OPERANDS]);
+  return acc;
+}
+
+static void bench(const char *name, mul_fn mul, fixedpt expect) {
+  uint64_t start = io_read(AM_TIMER_UPTIME).us;
+  fixedpt acc = run(mul);
+  uint64_t us = io_read(AM_TIMER_UPTIME).us - start;
+  uint64_t muls = (uint64_t)N_ROUNDS * N_OPERANDS;
+
+  if (us == 0)
+    us = 1;
+  /* multiplies per cycle, in thousandths */
+  uint32_t milli = (uint32_t)(muls * 1000 / (us * BENCH_CPU_MHZ));
+  printf("%s: %d muls in %d us, %d.%03d muls/cycle @ %d MHz %s\n", name,
+         (int)muls, (int)us, milli / 1000, milli % 1000, BENCH_CPU_MHZ,
+         acc == expect ? "ok" : "MISMATCH");
+}
+
+int main() {
+  ioe_init();
+
+  /* Keep products below 2^64 so that the carry-loop baseline is exact */
+  for (int i = 0; i < N_OPERANDS; i++) {
+    fixedpt v = (fixedpt)(lcg() >> 2);
+    operands[i] = (lcg() & 1) ? -v : v;
+  }
+
+  fixedpt expect = run(fixedpt_mul_limb);
+
+  bench("carryloop", fixedpt_mul_carryloop, expect);
+  bench("limb", fixedpt_mul_limb, expect);
+#if defined(__SIZEOF_INT128__)
+  bench("int128", fixedpt_mul_int128, expect);
+#endif
+  return 0;
+}
@@ -13,7 +13,8 @@ int main() {
   random_init_notype(m, k, A, m);
   random_init_notype(k, n, B, k);
 
-  matmul(m, n, k, A, m, B, k, C, m);
+  /* beta = 0: C is only written, so the uninitialized malloc is fine */
+  matmul_gemm(0, m, n, k, FIXEDPT_ONE, A, m, B, k, 0, C, m);
 
   if (m <= 8) {
     printf("Matrix A : \n");
@@ -26,5 +27,8 @@ int main() {
     display_notype(C, m, n);
   }
 
+#ifdef __ISA_NATIVE__
+  simd_model_report();
+#endif
   return 0;
 }
@@ -7,13 +7,600 @@
 #define B(i, j) b[(j) * ldb + (i)]
 #define C(i, j) c[(j) * ldc + (i)]
 
-/* Block sizes */
-#define mc 256
-#define kc 128
-#define nb 1000
+/* Profile written by `just tune`, see src/tune.c */
+#if defined(__has_include)
+#if __has_include("gemm_profile.h")
+#include "gemm_profile.h"
+#endif
+#endif
+
+/* Block sizes, see gemm_set_params() */
+static int mc = GEMM_DEFAULT_MC;
+static int kc = GEMM_DEFAULT_KC;
+static int nc = GEMM_DEFAULT_NC;
+static int strassen = GEMM_DEFAULT_STRASSEN;
+static int direct = GEMM_DEFAULT_DIRECT;
+static int gemv_rows = GEMM_DEFAULT_GEMV;
 
 #define min(i, j) ((i) < (j) ? (i) : (j))
 
+/*
+ * Micro-kernel for the 4x4 tiles of C, any routine with the signature of
+ * AddDot4x4 works on the packed panels. By default the SIMD device computes
+ * the tiles: with a single AddDot4x4xK command or on its register file
+ * (AddDot4x4_vregs) when the device advertises those, else with AddDot4x4.
+ * gemm_set_params() picks one of the kernels below by name, and a build
+ * with e.g. -DGEMM_KERNEL=AddDot4x4_wide forces any kernel. AddDot4x4_wide
+ * ("wide") only exists when GEMM_MR and GEMM_NR are 4.
+ */
+typedef void (*gemm_kernel_t)(int, fixedpt *, int, fixedpt *, int, fixedpt *,
+                              int);
+
+/* CPU kernel of the GEMM_MR x GEMM_NR register block, e.g. AddDot8x4_cpu */
+#define TILE_KERNEL_NAME(mr, nr) AddDot##mr##x##nr##_cpu
+#define TILE_KERNEL(mr, nr) TILE_KERNEL_NAME(mr, nr)
+#define AddDot_cpu TILE_KERNEL(GEMM_MR, GEMM_NR)
+
+#define GEMM_4X4 (GEMM_MR == 4 && GEMM_NR == 4)
+
+static const struct {
+  const char *name;
+  gemm_kernel_t fn;
+  uint32_t caps; /* SIMD_CAP bits the kernel needs */
+} kernels[] = {
+#if GEMM_4X4
+    {"dot4x4xk", AddDot4x4xK, SIMD_CAP_DOT4X4XK},
+    {"vregs", AddDot4x4_vregs, SIMD_CAP_VLANES},
+    {"simd", AddDot4x4, 0},
+    {"wide", AddDot4x4_wide, 0},
+#endif
+    {"cpu", AddDot_cpu, 0},
+};
+
+/*
+ * State of one call, which the entry points fill on their stack and hand
+ * down to InnerKernel() and AddDot_edge() with the panels, so that a call
+ * made while another is running, e.g. from the epilogue or a nested
+ * matmul(), does not clobber it. The block sizes, the workspaces and the
+ * SIMD ring are still shared, so calls must not overlap across harts:
+ *
+ * - the tile kernel,
+ * - whether A and B are stored transposed, see matmul_flags(). op(A)(i, p)
+ *   and op(B)(p, j) start the sub-matrices, and the panels are packed by
+ *   the routine that reads that layout,
+ * - the scales, C = alpha * op(A) * op(B) + beta * C, see matmul_gemm().
+ *   They are applied when the tiles are written back to C: beta by the
+ *   first kc block, alpha to the product of every block,
+ * - the epilogue, see matmul_gemm_ep(), or NULL. It is applied by the write
+ *   back of the last kc block, which is given the position of every tile in
+ *   the C of the call. With ep_rows the bias follows the rows of that C,
+ *   which is the user's row-major C^T.
+ */
+struct gemm_call {
+  gemm_kernel_t kernel;
+  int trans_a, trans_b;
+  fixedpt alpha, beta;
+  const gemm_epilogue *ep;
+  int ep_rows;
+};
+
+/* A call of C = A * B + C with kernel kern */
+#define PLAIN_CALL(kern)                                                       \
+  { kern, 0, 0, FIXEDPT_ONE, FIXEDPT_ONE, NULL, 0 }
+
+/* Fringe or scaled tiles that InnerKernel() stores after one fence */
+#define EDGE_TILES 8
+
+static void edge_store(const gemm_call *call, int m, int n,
+                       const fixedpt *tile, fixedpt beta, int last,
+                       fixedpt *c, int ldc, int row, int col);
+
+/* beta that the kc block at depth p applies to C */
+#define block_beta(call, p) ((p) == 0 ? (call)->beta : FIXEDPT_ONE)
+
+static fixedpt epilogue(const gemm_call *call, fixedpt v, int i, int j) {
+  /* The epilogue of call applied to the final value v of C(i, j) */
+  const gemm_epilogue *ep = call->ep;
+
+  if (ep->bias != NULL)
+    v += ep->bias[call->ep_rows ? i : j];
+  if (ep->act == GEMM_ACT_RELU && v < 0)
+    v = 0;
+  if (ep->clamp)
+    v = v < ep->lo ? ep->lo : v > ep->hi ? ep->hi : v;
+  return v;
+}
+
+/* op(A)(i, p), op(B)(p, j) and their packing routines for call */
+#define opA(call, i, p) ((call)->trans_a ? &A_row(i, p) : &A(i, p))
+#define opB(call, p, j) ((call)->trans_b ? &B_row(p, j) : &B(p, j))
+#define pack_panel_a(call, m, k, a, lda, a_to)                                 \
+  ((call)->trans_a ? PackMatrixA_T : PackMatrixA)(m, k, a, lda, a_to)
+#define pack_panel_b(call, n, k, b, ldb, b_to)                                 \
+  ((call)->trans_b ? PackMatrixB_T : PackMatrixB)(n, k, b, ldb, b_to)
+static int kernel_idx = -1; /* entry of kernels[], -1 when automatic */
+
+/* Whether the build or gemm_set_params() chose the tile kernel */
+#ifdef GEMM_KERNEL
+#define kernel_forced() 1
+#else
+#define kernel_forced() (kernel_idx >= 0)
+#endif
+
+static gemm_kernel_t select_kernel() {
+#ifdef GEMM_KERNEL
+  return GEMM_KERNEL;
+#else
+  if (kernel_idx >= 0)
+    return kernels[kernel_idx].fn;
+  if (!GEMM_4X4)
+    return AddDot_cpu;
+  if (simd_has(SIMD_CAP_DOT4X4XK))
+    return AddDot4x4xK;
+  if (simd_has(SIMD_CAP_VLANES))
+    return AddDot4x4_vregs;
+  return AddDot4x4;
+#endif
+}
+
+static int kernel_usable(int idx) {
+  return kernels[idx].caps == 0 || simd_has(kernels[idx].caps);
+}
+
+const char *gemm_kernel_name(int i) {
+  /* Name of the i-th kernel this device can run, NULL past the last one */
+  for (int idx = 0; idx < (int)LENGTH(kernels); idx++)
+    if (kernel_usable(idx))
+      if (i-- == 0)
+        return kernels[idx].name;
+  return NULL;
+}
+
+static void load_profile() {
+  static int loaded = 0;
+
+  if (loaded)
+    return;
+  loaded = 1;
+#ifdef GEMM_PROFILE
+  gemm_params p;
+  gemm_get_params(&p);
+  if (gemm_parse_params(GEMM_PROFILE, &p))
+    gemm_set_params(&p);
+#endif
+}
+
+void gemm_get_params(gemm_params *p) {
+  load_profile();
+  p->mc = mc;
+  p->kc = kc;
+  p->nc = nc;
+  p->kernel = kernel_idx >= 0 ? kernels[kernel_idx].name : NULL;
+  p->strassen = strassen;
+  p->direct = direct;
+  p->gemv = gemv_rows;
+}
+
+int gemm_set_params(const gemm_params *p) {
+  /*
+  Sets the block sizes and the tile kernel of later matmul() calls. mc and
+  nc must be multiples of GEMM_MR and GEMM_NR, the kernel one of
+  gemm_kernel_name(), direct at least 0 and gemv at least 1.
+  Returns 0 and keeps the current parameters when one of them is invalid.
+  */
+  int idx = -1;
+
+  load_profile();
+  if (p == NULL || p->mc < GEMM_MR || p->mc % GEMM_MR != 0 || p->kc < 1 ||
+      p->nc < GEMM_NR || p->nc % GEMM_NR != 0 || p->strassen < 1 ||
+      p->direct < 0 || p->gemv < 1) {
+    printf("Argument Error : Invalid block sizes for gemm_set_params()\n");
+    return 0;
+  }
+  if (p->kernel != NULL) {
+    for (int i = 0; i < (int)LENGTH(kernels); i++)
+      if (strcmp(kernels[i].name, p->kernel) == 0 && kernel_usable(i))
+        idx = i;
+    if (idx < 0) {
+      printf("Argument Error : Unknown kernel %s for gemm_set_params()\n",
+             p->kernel);
+      return 0;
+    }
+  }
+
+  mc = p->mc;
+  kc = p->kc;
+  nc = p->nc;
+  strassen = p->strassen;
+  direct = p->direct;
+  gemv_rows = p->gemv;
+  kernel_idx = idx;
+  return 1;
+}
+
+/*
+ * Device kernels are queued on the descriptor ring when the device has one,
+ * so the CPU packs the next panels while earlier tiles are computed. The
+ * packed panels are then double buffered: a buffer is only repacked once
+ * the commands reading it have completed.
+ */
+static int panel_buffers(gemm_kernel_t kern) {
+  if ((kern == AddDot4x4xK || kern == AddDot4x4_vregs) &&
+      simd_has(SIMD_CAP_RING))
+    return 2;
+  return 1;
+}
+
+/*
+ * matmul() splits the work over gemm_threads() CPUs once a problem has at
+ * least this many MACs. The SIMD device is a single MMIO resource that the
+ * CPUs cannot share, so the threads compute their tiles on the CPU.
+ */
+#define GEMM_MT_MIN_MACS (64 * 64 * 64)
+
+static gemm_kernel_t mt_kernel() {
+  gemm_kernel_t kern = select_kernel();
+  if (kern == AddDot4x4 || kern == AddDot4x4xK || kern == AddDot4x4_vregs)
+    kern = AddDot_cpu;
+  return kern;
+}
+
+/*
+ * Deep reductions with a small C, m * n <= k and at least two kc blocks,
+ * leave most threads idle when C is split, so the kc blocks are split
+ * instead (split-K).
+ */
+#define use_splitk(m, n, k, kb)                                                \
+  ((uint64_t)(m) * (n) <= (uint64_t)(k) && (k) >= 2 * (kb))
+
+/*
+ * Zero maps: the packing routines tell when a panel is all zero, as whole
+ * rows of a ReLU output or padding often are, and InnerKernel() skips the
+ * tiles of those panels. A packed block of A or B is followed by its map,
+ * one flag per panel, in the same workspace chunk.
+ */
+static size_t block_a_bytes(int m, int k) {
+  /* m x k block of A packed in GEMM_MR panels, and its zero map */
+  return ROUNDUP(m, GEMM_MR) * k * sizeof(fixedpt) +
+         ROUNDUP(m, GEMM_MR) / GEMM_MR;
+}
+
+static size_t block_b_bytes(int k, int n) {
+  return k * ROUNDUP(n, GEMM_NR) * sizeof(fixedpt) +
+         ROUNDUP(n, GEMM_NR) / GEMM_NR;
+}
+
+#define zero_map_a(packedA, m, k)                                              \
+  ((unsigned char *)((packedA) + ROUNDUP(m, GEMM_MR) * (k)))
+#define zero_map_b(packedB, k, n)                                              \
+  ((unsigned char *)((packedB) + (k) * ROUNDUP(n, GEMM_NR)))
+
+/*
+ * B packed once by matmul_pack_b(): every kc block of rows is stored as
+ * the GEMM_NR wide panels InnerKernel() reads, so block p starts at
+ * data[p * ROUNDUP(n, GEMM_NR)] and its panel of column j at j * pb. The
+ * zero map of all the panels follows, block by block.
+ */
+struct matmul_packed_b {
+  int k, n, kc;
+  fixedpt *data;
+  unsigned char *zero;
+  void *raw; /* allocation holding data and zero, or only zero when the
+                data is loaded in place */
+};
+
+#define packed_b_panel(bp, p, pb, j)                                           \
+  ((bp)->data + (size_t)(p) * ROUNDUP((bp)->n, GEMM_NR) + (size_t)(j) * (pb))
+#define packed_b_zero(bp, p, j)                                                \
+  ((bp)->zero +                                                                \
+   (size_t)(p) / (bp)->kc * (ROUNDUP((bp)->n, GEMM_NR) / GEMM_NR) +            \
+   (j) / GEMM_NR)
+
+static void matmul_blocked(int m, int n, int k, fixedpt *a, int lda,
+                           fixedpt *b, int ldb, fixedpt *c, int ldc,
+                           matmul_workspace *ws, const matmul_packed_b *bp,
+                           int flags, fixedpt alpha, fixedpt beta,
+                           const gemm_epilogue *ep);
+static void matmul_mt(gemm_call *call, int m, int n, int k, fixedpt *a,
+                      int lda, fixedpt *b, int ldb, fixedpt *c, int ldc,
+                      matmul_workspace *ws, const matmul_packed_b *bp);
+static void matmul_splitk(gemm_call *call, int m, int n, int k, fixedpt *a,
+                          int lda, fixedpt *b, int ldb, fixedpt *c, int ldc,
+                          matmul_workspace *ws, const matmul_packed_b *bp);
+
+/* Workspace used by matmul() when the caller does not provide one */
+static matmul_workspace *default_ws = NULL;
+
+static size_t workspace_bytes(int m, int n, int k, int kb) {
+  /* matmul_workspace_query() for blocks of depth kb */
+  size_t panel_a = block_a_bytes(min(m, mc), min(k, kb));
+  size_t panel_b = block_b_bytes(min(k, kb), min(n, nc));
+
+  return panel_buffers(select_kernel()) *
+         (ROUNDUP(panel_a, GEMM_CACHE_LINE) +
+          ROUNDUP(panel_b, GEMM_CACHE_LINE));
+}
+
+size_t matmul_workspace_query(int m, int n, int k) {
+  /*
+  Returns the number of bytes a workspace needs so that matmul_ws() on a
+  m x n x k problem never has to grow it: one mc x kc panel of A and one
+  kc x nc panel of B with their zero maps, each padded to a cache line, or
+  two of each when they are double buffered. Rows of A and columns of B
+  are rounded up to the GEMM_MR / GEMM_NR wide panels the packing routines
+  produce.
+  */
+  load_profile();
+  return workspace_bytes(m, n, k, kc);
+}
+
+/*
+ * Serialized matmul_packed_b: a header padded to a cache line, so that the
+ * panels stay aligned, followed by the packed data. matmul_packed_b_load()
+ * refuses blobs packed for another panel width or fixedpt format.
+ */
+#define PACKED_B_MAGIC 0x424d4547u /* "GEMB" */
+#define PACKED_B_VERSION 1
+
+typedef struct {
+  uint32_t magic, version;
+  uint32_t k, n, kc, nr, fbits;
+  uint32_t bytes; /* of packed data after the header */
+} packed_b_header;
+
+#define PACKED_B_DATA ROUNDUP(sizeof(packed_b_header), GEMM_CACHE_LINE)
+
+static size_t packed_b_bytes(int k, int n) {
+  return (size_t)k * ROUNDUP(n, GEMM_NR) * sizeof(fixedpt);
+}
+
+static size_t packed_b_map(int k, int n, int kb) {
+  /* Bytes of the zero map of a packed B */
+  return (size_t)((k + kb - 1) / kb) * (ROUNDUP(n, GEMM_NR) / GEMM_NR);
+}
+
+static void pack_b(matmul_packed_b *bp, int k, int n, fixedpt *b, int ldb,
+                   fixedpt *data) {
+  /*
+  Packs all of B into data, which holds packed_b_bytes(k, n) followed by
+  packed_b_map(k, n, kc) bytes for the zero map.
+  */
+  int p, pb, j;
+
+  bp->k = k;
+  bp->n = n;
+  bp->kc = kc;
+  bp->data = data;
+  bp->zero = (unsigned char *)data + packed_b_bytes(k, n);
+  for (p = 0; p < k; p += kc) {
+    pb = min(k - p, kc);
+    for (j = 0; j < n; j += GEMM_NR)
+      *packed_b_zero(bp, p, j) = PackMatrixB(min(n - j, GEMM_NR), pb, &B(p, j),
+                                             ldb, packed_b_panel(bp, p, pb, j));
+  }
+}
+
+static void scan_b(matmul_packed_b *bp) {
+  /* Rebuilds the zero map of a packed B loaded from a blob */
+  fixedpt *panel, any;
+  int p, pb, j, e;
+
+  for (p = 0; p < bp->k; p += bp->kc) {
+    pb = min(bp->k - p, bp->kc);
+    for (j = 0; j < bp->n; j += GEMM_NR) {
+      panel = packed_b_panel(bp, p, pb, j);
+      for (any = 0, e = 0; e < pb * GEMM_NR; e++)
+        any |= panel[e];
+      *packed_b_zero(bp, p, j) = any == 0;
+    }
+  }
+}
+
+matmul_packed_b *matmul_pack_b(int k, int n, fixedpt *b, int ldb) {
+  /*
+  Packs the k x n matrix B once, in the panels and with the kc of the
+  current parameters, for any number of matmul_prepacked() calls. Returns
+  NULL when out of memory. Free with matmul_packed_b_free().
+  */
+
+  if (b == NULL || k < 1 || n < 1) {
+    printf("Argument Error : Invalid input arguments to matmul_pack_b()\n");
+    return NULL;
+  }
+
+  load_profile();
+  matmul_packed_b *bp = (matmul_packed_b *)malloc(sizeof(matmul_packed_b));
+  void *raw = malloc(packed_b_bytes(k, n) + packed_b_map(k, n, kc) +
+                     GEMM_CACHE_LINE - 1);
+  if (bp == NULL || raw == NULL) {
+    printf("Allocation Error : Could not allocate the packed B\n");
+    free(bp);
+    free(raw);
+    return NULL;
+  }
+  bp->raw = raw;
+  pack_b(bp, k, n, b, ldb, (fixedpt *)ROUNDUP((uintptr_t)raw, GEMM_CACHE_LINE));
+  return bp;
+}
+
+void matmul_packed_b_free(matmul_packed_b *bp) {
+  if (bp == NULL)
+    return;
+  free(bp->raw);
+  free(bp);
+}
+
+size_t matmul_packed_b_size(const matmul_packed_b *bp) {
+  /* Bytes matmul_packed_b_save() writes */
+  return PACKED_B_DATA + packed_b_bytes(bp->k, bp->n);
+}
+
+size_t matmul_packed_b_save(const matmul_packed_b *bp, void *buf, size_t len) {
+  /*
+  Serializes bp into buf, which must hold matmul_packed_b_size() bytes.
+  Returns the number of bytes written, 0 when buf is too small.
+  */
+  packed_b_header h = {PACKED_B_MAGIC, PACKED_B_VERSION, bp->k, bp->n,
+                       bp->kc, GEMM_NR, FIXEDPT_FBITS,
+                       packed_b_bytes(bp->k, bp->n)};
+
+  if (buf == NULL || len < matmul_packed_b_size(bp)) {
+    printf("Argument Error : Buffer too small for matmul_packed_b_save()\n");
+    return 0;
+  }
+  memset(buf, 0, PACKED_B_DATA);
+  memcpy(buf, &h, sizeof(h));
+  memcpy((char *)buf + PACKED_B_DATA, bp->data, h.bytes);
+  return PACKED_B_DATA + h.bytes;
+}
+
+matmul_packed_b *matmul_packed_b_load(const void *buf, size_t len) {
+  /*
+  Loads a packed B written by matmul_packed_b_save(), e.g. a blob linked
+  into the image. When buf is aligned to a fixedpt the handle uses the
+  panels in place and buf must outlive it, otherwise they are copied.
+  */
+  packed_b_header h;
+  matmul_packed_b *bp;
+
+  if (buf == NULL || len < PACKED_B_DATA) {
+    printf("Argument Error : Invalid buffer for matmul_packed_b_load()\n");
+    return NULL;
+  }
+  memcpy(&h, buf, sizeof(h));
+  if (h.magic != PACKED_B_MAGIC || h.version != PACKED_B_VERSION ||
+      h.nr != GEMM_NR || h.fbits != FIXEDPT_FBITS || h.kc < 1 ||
+      h.bytes != packed_b_bytes(h.k, h.n) || len < PACKED_B_DATA + h.bytes) {
+    printf("Argument Error : matmul_packed_b_load() got a blob packed for "
+           "another build\n");
+    return NULL;
+  }
+
+  if ((bp = (matmul_packed_b *)malloc(sizeof(matmul_packed_b))) == NULL) {
+    printf("Allocation Error : Could not allocate the packed B\n");
+    return NULL;
+  }
+  bp->k = h.k;
+  bp->n = h.n;
+  bp->kc = h.kc;
+  bp->data = (fixedpt *)((const char *)buf + PACKED_B_DATA);
+
+  /* The zero map is not saved, so it is rebuilt in memory of our own */
+  int copy = (uintptr_t)bp->data % sizeof(fixedpt) != 0;
+  size_t map = packed_b_map(h.k, h.n, h.kc);
+  void *raw = malloc((copy ? h.bytes : 0) + map + GEMM_CACHE_LINE - 1);
+  if (raw == NULL) {
+    printf("Allocation Error : Could not allocate the packed B\n");
+    free(bp);
+    return NULL;
+  }
+  bp->raw = raw;
+  bp->zero = (unsigned char *)raw;
+  if (copy) {
+    bp->data = (fixedpt *)ROUNDUP((uintptr_t)raw, GEMM_CACHE_LINE);
+    bp->zero = (unsigned char *)bp->data + h.bytes;
+    memcpy(bp->data, (const char *)buf + PACKED_B_DATA, h.bytes);
+  }
+  scan_b(bp);
+  return bp;
+}
+
+/*
+ * Shape dispatch of matmul(). Packing pays off when every packed value is
+ * read by many tiles. A matrix-vector product reads every value of the
+ * matrix once, and operands that fit in the L1 cache are read as fast in
+ * place, so those go to the routines below, which need no workspace: a
+ * product with n or m equal to 1, whatever its size, and one whose A, B and
+ * C take at most direct KiB (gemm_params). direct = 0 packs every problem.
+ * The problems that matmul() splits over threads are always packed.
+ */
+
+static void gemv(int m, int k, fixedpt *a, int lda, fixedpt *b, fixedpt *c) {
+  /*
+  c += A * b, reading A once, column by column, for gemv rows of c at a
+  time so that they stay in the cache (gemm_params)
+  */
+  int i, i1, j, p;
+
+  for (i = 0; i < m; i = i1) {
+    i1 = min(m, i + gemv_rows);
+    for (p = 0; p < k; p++)
+      for (j = i; j < i1; j++)
+        c[j] = fixedpt_add(c[j], fixedpt_mul(A(j, p), b[p]));
+  }
+}
+
+static void gevm(int n, int k, fixedpt *a, int lda, fixedpt *b, int ldb,
+                 fixedpt *c, int ldc) {
+  /* c += a * B for the row vector a, reading B once, column by column */
+  fixedpt sum;
+  int j, p;
+
+  for (j = 0; j < n; j++) {
+    sum = 0;
+    for (p = 0; p < k; p++)
+      sum = fixedpt_add(sum, fixedpt_mul(A(0, p), B(p, j)));
+    C(0, j) = fixedpt_add(C(0, j), sum);
+  }
+}
+
+static void direct_tile(int m, int n, int k, fixedpt *a, int lda, fixedpt *b,
+                        int ldb, fixedpt *c, int ldc) {
+  /*
+  One m x n <= GEMM_MR x GEMM_NR tile of C from A and B in place, as the
+  unpacked AddDot4x4 of src/baseline_gemm.c. Full tiles have constant
+  bounds so the loops unroll.
+  */
+  fixedpt acc[GEMM_MR * GEMM_NR] = {0};
+  int i, j, p;
+
+  if (m == GEMM_MR && n == GEMM_NR)
+    for (p = 0; p < k; p++)
+      for (j = 0; j < GEMM_NR; j++)
+        for (i = 0; i < GEMM_MR; i++)
+          acc[j * GEMM_MR + i] =
+              fixedpt_add(acc[j * GEMM_MR + i], fixedpt_mul(A(i, p), B(p, j)));
+  else
+    for (p = 0; p < k; p++)
+      for (j = 0; j < n; j++)
+        for (i = 0; i < m; i++)
+          acc[j * GEMM_MR + i] =
+              fixedpt_add(acc[j * GEMM_MR + i], fixedpt_mul(A(i, p), B(p, j)));
+
+  for (j = 0; j < n; j++)
+    for (i = 0; i < m; i++)
+      C(i, j) = fixedpt_add(C(i, j), acc[j * GEMM_MR + i]);
+}
+
+static int matmul_direct(int m, int n, int k, fixedpt *a, int lda,
+                         fixedpt *b, int ldb, fixedpt *c, int ldc) {
+  /*
+  Computes the problems that are not worth packing, returns 0 for others.
+  These paths do not run the tile kernel, so a forced one always packs.
+  */
+  size_t bytes = ((size_t)m * k + (size_t)k * n + (size_t)m * n) *
+                 sizeof(fixedpt);
+  int i, j;
+
+  load_profile();
+  if (direct == 0 || kernel_forced() ||
+      (gemm_threads() > 1 && (uint64_t)m * n * k >= GEMM_MT_MIN_MACS))
+    return 0;
+
+  if (n == 1)
+    gemv(m, k, a, lda, b, c);
+  else if (m == 1)
+    gevm(n, k, a, lda, b, ldb, c, ldc);
+  else if (bytes <= (size_t)direct * 1024)
+    for (j = 0; j < n; j += GEMM_NR)
+      for (i = 0; i < m; i += GEMM_MR)
+        direct_tile(min(m - i, GEMM_MR), min(n - j, GEMM_NR), k, &A(i, 0), lda,
+                    &B(0, j), ldb, &C(i, j), ldc);
+  else
+    return 0;
+  return 1;
+}
+
 /* Routine for computing C = A * B + C */
 
 void matmul(int m, int n, int k, fixedpt *a, int lda, fixedpt *b, int ldb,
@@ -36,68 +623,932 @@ void matmul(int m, int n, int k, fixedpt *a, int lda, fixedpt *b, int ldb,
           None
   */
 
-  if (a == NULL || b == NULL || c == NULL) {
+  if (default_ws == NULL)
+    default_ws = matmul_workspace_create(0);
+  matmul_ws(m, n, k, a, lda, b, ldb, c, ldc, default_ws);
+}
+
+void matmul_ws(int m, int n, int k, fixedpt *a, int lda, fixedpt *b, int ldb,
+               fixedpt *c, int ldc, matmul_workspace *ws) {
+  /*
+  Same as matmul(), but packs A and B into the caller's workspace. The
+  workspace grows on demand and is reused by every block of this call and
+  by later calls, see matmul_workspace_query() to size it up front.
+  */
+
+  if (a == NULL || b == NULL || c == NULL || ws == NULL) {
     printf(
         "Argument Error : One of the input arguments to matmul() was NULL\n");
     return;
   }
 
-  int i, p, pb, ib;
+  if (matmul_direct(m, n, k, a, lda, b, ldb, c, ldc))
+    return;
+  matmul_blocked(m, n, k, a, lda, b, ldb, c, ldc, ws, NULL, 0, FIXEDPT_ONE,
+                 FIXEDPT_ONE, NULL);
+}
+
+#if FIXEDPT_BITS == 64 && FIXEDPT_FBITS == 8
+void matmul_q56_8(int m, int n, int k, fixedpt_q56_8 *a, int lda,
+                  fixedpt_q56_8 *b, int ldb, fixedpt_q56_8 *c, int ldc) {
+  /* matmul() under the name of its format, next to matmul_q24_8() */
+  matmul(m, n, k, a, lda, b, ldb, c, ldc);
+}
+#endif
+
+void matmul_flags(int flags, int m, int n, int k, fixedpt *a, int lda,
+                  fixedpt *b, int ldb, fixedpt *c, int ldc) {
+  /*
+  matmul() for operands in other layouts, C = op(A) * op(B) + C with op(A)
+  m x k and op(B) k x n. With GEMM_TRANS_A (GEMM_TRANS_B) A (B) is stored
+  transposed, which the packing routines undo while copying the panels.
+  With GEMM_ROW_MAJOR all three matrices are row-major; the row-major C is
+  the column-major C^T = op(B)^T * op(A)^T, so the operands swap places.
+  */
+  matmul_gemm(flags, m, n, k, FIXEDPT_ONE, a, lda, b, ldb, FIXEDPT_ONE, c,
+              ldc);
+}
+
+void matmul_gemm(int flags, int m, int n, int k, fixedpt alpha, fixedpt *a,
+                 int lda, fixedpt *b, int ldb, fixedpt beta, fixedpt *c,
+                 int ldc) {
+  /*
+  Full GEMM, C = alpha * op(A) * op(B) + beta * C, with the flags of
+  matmul_flags(). Both scales are applied while the tiles are written back,
+  and with beta == 0 C is only written, never read, so it need not be
+  initialized. alpha scales the product of every kc block and fixedpt_mul()
+  truncates, so with alpha != 1 the last bits of C depend on kc.
+  */
+  matmul_gemm_ep(flags, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, NULL);
+}
+
+void matmul_gemm_ep(int flags, int m, int n, int k, fixedpt alpha,
+                    fixedpt *a, int lda, fixedpt *b, int ldb, fixedpt beta,
+                    fixedpt *c, int ldc, const gemm_epilogue *ep) {
+  /*
+  matmul_gemm() followed by the epilogue ep, which may be NULL: every
+  C(i, j) becomes clamp(act(alpha * op(A) * op(B) + beta * C + bias[j])).
+  It is fused into the write back of the last kc block, so C is not read
+  again after the product.
+  */
+  int i, j;
+
+  if (a == NULL || b == NULL || c == NULL) {
+    printf("Argument Error : One of the input arguments to matmul_gemm() "
+           "was NULL\n");
+    return;
+  }
+  if (ep != NULL && ((ep->act != GEMM_ACT_NONE && ep->act != GEMM_ACT_RELU) ||
+                     (ep->clamp && ep->lo > ep->hi))) {
+    printf("Argument Error : Invalid epilogue passed to matmul_gemm_ep()\n");
+    return;
+  }
+
+  if (flags & GEMM_ROW_MAJOR) {
+    int t = m;
+    fixedpt *p = a;
+
+    m = n;
+    n = t;
+    a = b;
+    b = p;
+    t = lda;
+    lda = ldb;
+    ldb = t;
+    flags = GEMM_ROW_MAJOR | (flags & GEMM_TRANS_B ? GEMM_TRANS_A : 0) |
+            (flags & GEMM_TRANS_A ? GEMM_TRANS_B : 0);
+  }
+
+  if (k < 1) { /* no product, only C = beta * C */
+    gemm_call call = {NULL, 0, 0, alpha, beta, ep,
+                      (flags & GEMM_ROW_MAJOR) != 0};
+
+    for (j = 0; j < n; j++)
+      for (i = 0; i < m; i++) {
+        C(i, j) = beta == 0 ? 0 : fixedpt_mul(beta, C(i, j));
+        if (ep != NULL)
+          C(i, j) = epilogue(&call, C(i, j), i, j);
+      }
+    return;
+  }
+
+  if (default_ws == NULL)
+    default_ws = matmul_workspace_create(0);
+  if (default_ws == NULL)
+    return;
+  /* Only the plain product takes the unpacked paths of matmul() */
+  if (!(flags & (GEMM_TRANS_A | GEMM_TRANS_B)) && alpha == FIXEDPT_ONE &&
+      beta == FIXEDPT_ONE && ep == NULL &&
+      matmul_direct(m, n, k, a, lda, b, ldb, c, ldc))
+    return;
+  matmul_blocked(m, n, k, a, lda, b, ldb, c, ldc, default_ws, NULL, flags,
+                 alpha, beta, ep);
+}
+
+void matmul_prepacked(int m, int n, int k, fixedpt *a, int lda,
+                      const matmul_packed_b *bp, fixedpt *c, int ldc) {
+  /*
+  Same as matmul() with B taken from matmul_pack_b(), so only A is packed.
+  bp must have been packed from a k x n matrix.
+  */
+
+  if (a == NULL || bp == NULL || c == NULL) {
+    printf("Argument Error : One of the input arguments to "
+           "matmul_prepacked() was NULL\n");
+    return;
+  }
+  if (bp->k != k || bp->n != n) {
+    printf("Argument Error : matmul_prepacked() got a packed B of %dx%d for "
+           "a %dx%d operand\n",
+           bp->k, bp->n, k, n);
+    return;
+  }
+
+  if (default_ws == NULL)
+    default_ws = matmul_workspace_create(0);
+  if (default_ws != NULL)
+    matmul_blocked(m, n, k, a, lda, NULL, 0, c, ldc, default_ws, bp, 0,
+                   FIXEDPT_ONE, FIXEDPT_ONE, NULL);
+}
+
+static void matmul_blocked(int m, int n, int k, fixedpt *a, int lda,
+                           fixedpt *b, int ldb, fixedpt *c, int ldc,
+                           matmul_workspace *ws, const matmul_packed_b *bp,
+                           int flags, fixedpt alpha, fixedpt beta,
+                           const gemm_epilogue *ep) {
+  /*
+  Blocked matmul behind matmul_ws(), matmul_prepacked() and matmul_gemm().
+  When bp is set the kc x nc panels of B are read from it instead of being
+  packed, and the depth of the blocks is the one B was packed with. The
+  operands are already column-major here: GEMM_ROW_MAJOR in flags only
+  tells that the bias of ep follows the rows of C.
+  */
+  gemm_call state = {select_kernel(),
+                     (flags & GEMM_TRANS_A) != 0,
+                     (flags & GEMM_TRANS_B) != 0,
+                     alpha,
+                     beta,
+                     ep,
+                     (flags & GEMM_ROW_MAJOR) != 0};
+  gemm_call *call = &state;
+  int kb;
+
+  load_profile();
+  kb = bp ? bp->kc : kc;
+
+  /* A prepacked B sets the depth, which kc may have changed since */
+  if (!matmul_workspace_reserve(ws, workspace_bytes(m, n, k, kb))) {
+    printf("Allocation Error : Could not grow the matmul() workspace\n");
+    return;
+  }
+
+  if (gemm_threads() > 1 && (uint64_t)m * n * k >= GEMM_MT_MIN_MACS) {
+    if (use_splitk(m, n, k, kb))
+      matmul_splitk(call, m, n, k, a, lda, b, ldb, c, ldc, ws, bp);
+    else
+      matmul_mt(call, m, n, k, a, lda, b, ldb, c, ldc, ws, bp);
+    return;
+  }
+
+  int i, j, p, pb, ib, jb, nbuf, sa = 0, sb = 0;
+  fixedpt *packedA[2], *packedB[2] = {NULL, NULL};
+  unsigned char *zeroA[2], *zeroB[2] = {NULL, NULL};
+  uint32_t fenceA[2] = {0, 0}, fenceB[2] = {0, 0};
+
+  nbuf = panel_buffers(call->kernel);
+  matmul_workspace_reset(ws);
+  for (i = 0; i < nbuf; i++) {
+    packedA[i] = (fixedpt *)matmul_workspace_alloc(
+        ws, block_a_bytes(min(m, mc), min(k, kb)));
+    zeroA[i] = zero_map_a(packedA[i], min(m, mc), min(k, kb));
+    if (bp == NULL) {
+      packedB[i] = (fixedpt *)matmul_workspace_alloc(
+          ws, block_b_bytes(min(k, kb), min(n, nc)));
+      zeroB[i] = zero_map_b(packedB[i], min(k, kb), min(n, nc));
+    }
+    if (packedA[i] == NULL || (bp == NULL && packedB[i] == NULL)) {
+      printf("Allocation Error : The matmul() workspace is too small\n");
+      return;
+    }
+  }
+  if (nbuf == 2)
+    simd_ring_enable();
+
+  /* This time, we compute a mc x nc block of C by a call to the InnerKernel */
 
-  /* This time, we compute a mc x n block of C by a call to the InnerKernel */
+  for (j = 0; j < n; j += nc) {
+    jb = min(n - j, nc);
+    for (p = 0; p < k; p += kb) {
+      pb = min(k - p, kb);
+      simd_ring_wait(fenceB[sb]);
+      for (i = 0; i < m; i += mc) {
+        ib = min(m - i, mc);
+        simd_ring_wait(fenceA[sa]);
+        if (bp)
+          InnerKernel(call, ib, jb, pb, opA(call, i, p), lda, NULL, 0,
+                      &C(i, j), ldc, i, j, 0, block_beta(call, p), p + pb == k,
+                      packedA[sa], packed_b_panel(bp, p, pb, j), zeroA[sa],
+                      packed_b_zero(bp, p, j));
+        else
+          InnerKernel(call, ib, jb, pb, opA(call, i, p), lda, opB(call, p, j),
+                      ldb, &C(i, j), ldc, i, j, i == 0, block_beta(call, p),
+                      p + pb == k, packedA[sa], packedB[sb], zeroA[sa],
+                      zeroB[sb]);
+        fenceA[sa] = fenceB[sb] = simd_ring_submit();
+        sa = (sa + 1) % nbuf;
+      }
+      sb = (sb + 1) % nbuf;
+    }
+  }
+
+  if (nbuf == 2)
+    simd_ring_disable();
+  return;
+}
+
+/*
+ * Parallel matmul. Every thread owns a GEMM_NR aligned range of columns of
+ * C, or of rows when there are fewer column panels than threads, and packs
+ * its own A panels. The k x n panel of B is shared: the threads pack it
+ * together, unless it was packed by matmul_pack_b(), and meet at a barrier
+ * before using it and before it is overwritten.
+ */
+
+typedef struct {
+  int m, n, k;
+  fixedpt *a, *b, *c;
+  int lda, ldb, ldc;
+  int kc;                        /* depth of the blocks */
+  const matmul_packed_b *packed; /* B from matmul_pack_b(), or NULL */
+  const gemm_call *call;
+  fixedpt *packedA[GEMM_MAX_THREADS];
+  fixedpt *packedB[GEMM_MAX_THREADS]; /* only [0] unless split-K */
+  fixedpt *partial[GEMM_MAX_THREADS]; /* split-K only, m x n */
+  unsigned char *zeroA[GEMM_MAX_THREADS], *zeroB[GEMM_MAX_THREADS];
+} mt_job;
+
+static matmul_workspace *thread_ws[GEMM_MAX_THREADS];
+
+static matmul_workspace *thread_workspace(int t, matmul_workspace *ws,
+                                          size_t size) {
+  /* Workspace of thread t, the caller's one for thread 0, reset and grown */
+  if (t > 0 && thread_ws[t] == NULL)
+    thread_ws[t] = matmul_workspace_create(0);
+  if (t > 0)
+    ws = thread_ws[t];
+
+  if (ws == NULL || !matmul_workspace_reserve(ws, size)) {
+    printf("Allocation Error : Could not grow the matmul() workspace\n");
+    return NULL;
+  }
+  matmul_workspace_reset(ws);
+  return ws;
+}
+
+static void matmul_mt_worker(int tid, int nthreads, void *arg) {
+  mt_job *job = (mt_job *)arg;
+  int m = job->m, n = job->n, k = job->k;
+  int lda = job->lda, ldb = job->ldb, ldc = job->ldc;
+  fixedpt *a = job->a, *b = job->b, *c = job->c;
+  const matmul_packed_b *bp = job->packed;
+  const gemm_call *call = job->call;
+  int panels_m = (m + GEMM_MR - 1) / GEMM_MR;
+  int panels_n = (n + GEMM_NR - 1) / GEMM_NR;
+  int i0 = 0, i1 = m, j0 = 0, j1 = n, i, j, p, pb, ib, kc = job->kc;
+  fixedpt *panel;
+  unsigned char *zero;
+
+  if (panels_n >= nthreads) {
+    j0 = min(n, panels_n * tid / nthreads * GEMM_NR);
+    j1 = min(n, panels_n * (tid + 1) / nthreads * GEMM_NR);
+  } else {
+    i0 = min(m, panels_m * tid / nthreads * GEMM_MR);
+    i1 = min(m, panels_m * (tid + 1) / nthreads * GEMM_MR);
+  }
 
   for (p = 0; p < k; p += kc) {
     pb = min(k - p, kc);
+    panel = bp ? packed_b_panel(bp, p, pb, 0) : job->packedB[0];
+    zero = bp ? packed_b_zero(bp, p, 0) : job->zeroB[0];
+    if (bp == NULL) {
+      for (j = tid * GEMM_NR; j < n; j += nthreads * GEMM_NR)
+        zero[j / GEMM_NR] = pack_panel_b(call, min(n - j, GEMM_NR), pb,
+                                         opB(call, p, j), ldb, &panel[j * pb]);
+      gemm_barrier();
+    }
+
+    for (i = i0; i < i1 && j0 < j1; i += mc) {
+      ib = min(i1 - i, mc);
+      InnerKernel(call, ib, j1 - j0, pb, opA(call, i, p), lda, NULL, 0,
+                  &C(i, j0), ldc, i, j0, 0, block_beta(call, p), p + pb == k,
+                  job->packedA[tid], &panel[j0 * pb], job->zeroA[tid],
+                  &zero[j0 / GEMM_NR]);
+    }
+    if (bp == NULL)
+      gemm_barrier();
+  }
+}
+
+static void matmul_mt(gemm_call *call, int m, int n, int k, fixedpt *a,
+                      int lda, fixedpt *b, int ldb, fixedpt *c, int ldc,
+                      matmul_workspace *ws, const matmul_packed_b *bp) {
+  /*
+  The caller's workspace holds the shared B panel and the A panels of
+  thread 0, the other threads get a workspace of their own.
+  */
+  int kb = bp ? bp->kc : kc;
+  size_t panel_a = block_a_bytes(min(m, mc), min(k, kb));
+  size_t panel_b = bp ? 0 : block_b_bytes(min(k, kb), n);
+  mt_job job = {m, n, k, a, b, c, lda, ldb, ldc, kb, bp, call};
+  matmul_workspace *w;
+  int t;
+
+  call->kernel = mt_kernel();
+  for (t = 0; t < gemm_threads(); t++) {
+    w = thread_workspace(t, ws,
+                         ROUNDUP(panel_a, GEMM_CACHE_LINE) +
+                             (t ? 0 : ROUNDUP(panel_b, GEMM_CACHE_LINE)));
+    if (w == NULL)
+      return;
+    if (t == 0 && bp == NULL) {
+      job.packedB[0] = (fixedpt *)matmul_workspace_alloc(w, panel_b);
+      job.zeroB[0] = zero_map_b(job.packedB[0], min(k, kb), n);
+    }
+    job.packedA[t] = (fixedpt *)matmul_workspace_alloc(w, panel_a);
+    job.zeroA[t] = zero_map_a(job.packedA[t], min(m, mc), min(k, kb));
+  }
+
+  gemm_parallel(matmul_mt_worker, &job);
+}
+
+/*
+ * Split-K matmul. Every thread takes a contiguous range of kc blocks and
+ * computes A(:, range) * B(range, :) into a private m x n partial C with its
+ * own packed panels. The partials are then added to C column by column, in
+ * thread order, so the result does not depend on the timing of the threads.
+ */
+
+static void matmul_splitk_worker(int tid, int nthreads, void *arg) {
+  mt_job *job = (mt_job *)arg;
+  int m = job->m, n = job->n, k = job->k;
+  int lda = job->lda, ldb = job->ldb, ldc = job->ldc;
+  fixedpt *a = job->a, *b = job->b, *c = job->c;
+  fixedpt *partial = job->partial[tid];
+  const matmul_packed_b *bp = job->packed;
+  const gemm_call *call = job->call;
+  int kc = job->kc;
+  int blocks = (k + kc - 1) / kc;
+  int p0 = min(k, blocks * tid / nthreads * kc);
+  int p1 = min(k, blocks * (tid + 1) / nthreads * kc);
+  int i, j, p, pb, ib, t;
+
+  memset(partial, 0, (size_t)m * n * sizeof(fixedpt));
+  for (p = p0; p < p1; p += kc) {
+    pb = min(p1 - p, kc);
     for (i = 0; i < m; i += mc) {
       ib = min(m - i, mc);
-      InnerKernel(ib, n, pb, &A(i, p), lda, &B(p, 0), ldb, &C(i, 0), ldc,
-                  i == 0);
+      if (bp)
+        InnerKernel(call, ib, n, pb, opA(call, i, p), lda, NULL, 0,
+                    &partial[i], m, i, 0, 0, FIXEDPT_ONE, 0, job->packedA[tid],
+                    packed_b_panel(bp, p, pb, 0), job->zeroA[tid],
+                    packed_b_zero(bp, p, 0));
+      else
+        InnerKernel(call, ib, n, pb, opA(call, i, p), lda, opB(call, p, 0), ldb,
+                    &partial[i], m, i, 0, i == 0, FIXEDPT_ONE, 0,
+                    job->packedA[tid], job->packedB[tid], job->zeroA[tid],
+                    job->zeroB[tid]);
+    }
+  }
+  gemm_barrier();
+
+  for (j = n * tid / nthreads; j < n * (tid + 1) / nthreads; j++) {
+    for (i = 0; i < m; i++)
+      C(i, j) = call->beta == 0             ? 0
+                : call->beta == FIXEDPT_ONE ? C(i, j)
+                                            : fixedpt_mul(call->beta, C(i, j));
+    for (t = 0; t < nthreads; t++)
+      for (i = 0; i < m; i++)
+        C(i, j) += job->partial[t][j * m + i];
+    if (call->ep != NULL)
+      for (i = 0; i < m; i++)
+        C(i, j) = epilogue(call, C(i, j), i, j);
+  }
+}
+
+static void matmul_splitk(gemm_call *call, int m, int n, int k, fixedpt *a,
+                          int lda, fixedpt *b, int ldb, fixedpt *c, int ldc,
+                          matmul_workspace *ws, const matmul_packed_b *bp) {
+  int kb = bp ? bp->kc : kc;
+  size_t panel_a = block_a_bytes(min(m, mc), kb);
+  size_t panel_b = bp ? 0 : block_b_bytes(kb, n);
+  size_t partial = (size_t)m * n * sizeof(fixedpt);
+  mt_job job = {m, n, k, a, b, c, lda, ldb, ldc, kb, bp, call};
+  matmul_workspace *w;
+  int t;
+
+  call->kernel = mt_kernel();
+  for (t = 0; t < gemm_threads(); t++) {
+    w = thread_workspace(t, ws, ROUNDUP(panel_a, GEMM_CACHE_LINE) +
+                                    ROUNDUP(panel_b, GEMM_CACHE_LINE) +
+                                    ROUNDUP(partial, GEMM_CACHE_LINE));
+    if (w == NULL)
+      return;
+    job.packedA[t] = (fixedpt *)matmul_workspace_alloc(w, panel_a);
+    job.packedB[t] = (fixedpt *)matmul_workspace_alloc(w, panel_b);
+    job.partial[t] = (fixedpt *)matmul_workspace_alloc(w, partial);
+    job.zeroA[t] = zero_map_a(job.packedA[t], min(m, mc), kb);
+    job.zeroB[t] = zero_map_b(job.packedB[t], kb, n);
+  }
+
+  gemm_parallel(matmul_splitk_worker, &job);
+}
+
+/*
+ * Batched matmul of many small problems. The arguments are checked, the
+ * kernel picked and the panels allocated once for the whole batch, and
+ * every thread takes a contiguous range of items with its own workspace.
+ * When all items share B (stride_b == 0, or the same pointer in the array
+ * variant) it is packed once for the batch instead of once per item.
+ */
+
+typedef struct {
+  int count, m, n, k;
+  fixedpt *a, *b, *c;
+  int lda, ldb, ldc;
+  size_t stride_a, stride_b, stride_c;
+  fixedpt **ap, **bp, **cp;      /* pointer-array variant, else NULL */
+  int share_b;                   /* every item has the same B */
+  const matmul_packed_b *shared; /* that B, packed once */
+  gemm_call call;
+  fixedpt *packedA[GEMM_MAX_THREADS];
+  fixedpt *packedB[GEMM_MAX_THREADS];
+  unsigned char *zeroA[GEMM_MAX_THREADS], *zeroB[GEMM_MAX_THREADS];
+} batch_job;
+
+static void matmul_item(const gemm_call *call, int m, int n, int k, fixedpt *a,
+                        int lda, fixedpt *b, int ldb, fixedpt *c, int ldc,
+                        fixedpt *packedA, fixedpt *packedB,
+                        unsigned char *zeroA, unsigned char *zeroB,
+                        const matmul_packed_b *bp) {
+  /* The block loops of matmul_blocked() with single buffered panels */
+  int i, j, p, pb, ib, jb, kb = bp ? bp->kc : kc;
+
+  for (j = 0; j < n; j += nc) {
+    jb = min(n - j, nc);
+    for (p = 0; p < k; p += kb) {
+      pb = min(k - p, kb);
+      for (i = 0; i < m; i += mc) {
+        ib = min(m - i, mc);
+        if (bp)
+          InnerKernel(call, ib, jb, pb, opA(call, i, p), lda, NULL, 0,
+                      &C(i, j), ldc, i, j, 0, FIXEDPT_ONE, 0, packedA,
+                      packed_b_panel(bp, p, pb, j), zeroA,
+                      packed_b_zero(bp, p, j));
+        else
+          InnerKernel(call, ib, jb, pb, opA(call, i, p), lda, opB(call, p, j),
+                      ldb, &C(i, j), ldc, i, j, i == 0, FIXEDPT_ONE, 0,
+                      packedA, packedB, zeroA, zeroB);
+      }
+    }
+  }
+}
+
+void gemm_blocks(int m, int n, int k, gemm_block_fn fn, void *arg) {
+  /*
+  The block loops of matmul() for the kernels of other element types, see
+  matmul_quant(): fn gets every mc x kc block of A at (i, p) against the
+  kc x nc panel of B at (p, j), in the order of matmul_blocked() and with
+  the block sizes of gemm_get_params(). first is set for the first block
+  of rows of a panel, which is when B has to be packed.
+  */
+  int i, j, p, ib, jb, pb;
+
+  load_profile();
+  for (j = 0; j < n; j += nc) {
+    jb = min(n - j, nc);
+    for (p = 0; p < k; p += kc) {
+      pb = min(k - p, kc);
+      for (i = 0; i < m; i += mc) {
+        ib = min(m - i, mc);
+        fn(arg, i, j, p, ib, jb, pb, i == 0);
+      }
+    }
+  }
+}
+
+static void matmul_batch_worker(int tid, int nthreads, void *arg) {
+  batch_job *job = (batch_job *)arg;
+  int i0 = job->count * tid / nthreads, i1 = job->count * (tid + 1) / nthreads;
+
+  for (int i = i0; i < i1; i++) {
+    fixedpt *a = job->ap ? job->ap[i] : job->a + i * job->stride_a;
+    fixedpt *b = job->bp ? job->bp[i] : job->b + i * job->stride_b;
+    fixedpt *c = job->cp ? job->cp[i] : job->c + i * job->stride_c;
+    matmul_item(&job->call, job->m, job->n, job->k, a, job->lda, b, job->ldb,
+                c, job->ldc, job->packedA[tid], job->packedB[tid],
+                job->zeroA[tid], job->zeroB[tid], job->shared);
+  }
+}
+
+static void matmul_batch(batch_job *job) {
+  int m = job->m, n = job->n, k = job->k, t, nthreads = gemm_threads();
+  size_t panel_a = block_a_bytes(min(m, mc), min(k, kc));
+  size_t panel_b = job->share_b ? 0 : block_b_bytes(min(k, kc), min(n, nc));
+  size_t shared =
+      job->share_b ? packed_b_bytes(k, n) + packed_b_map(k, n, kc) : 0;
+  matmul_packed_b packed;
+  matmul_workspace *w;
+
+  if (job->count < 2 ||
+      (uint64_t)job->count * m * n * k < GEMM_MT_MIN_MACS)
+    nthreads = 1;
+  if (default_ws == NULL)
+    default_ws = matmul_workspace_create(0);
+
+  job->call = (gemm_call)PLAIN_CALL(nthreads > 1 ? mt_kernel()
+                                                : select_kernel());
+  for (t = 0; t < nthreads; t++) {
+    w = thread_workspace(t, default_ws,
+                         ROUNDUP(panel_a, GEMM_CACHE_LINE) +
+                             ROUNDUP(panel_b, GEMM_CACHE_LINE) +
+                             (t ? 0 : ROUNDUP(shared, GEMM_CACHE_LINE)));
+    if (w == NULL)
+      return;
+    job->packedA[t] = (fixedpt *)matmul_workspace_alloc(w, panel_a);
+    job->zeroA[t] = zero_map_a(job->packedA[t], min(m, mc), min(k, kc));
+    if (!job->share_b) { /* else all threads read the B packed below */
+      job->packedB[t] = (fixedpt *)matmul_workspace_alloc(w, panel_b);
+      job->zeroB[t] = zero_map_b(job->packedB[t], min(k, kc), min(n, nc));
+    } else if (t == 0) {
+      pack_b(&packed, k, n, job->bp ? job->bp[0] : job->b, job->ldb,
+             (fixedpt *)matmul_workspace_alloc(w, shared));
+      job->shared = &packed;
+    }
+  }
+
+  if (nthreads > 1)
+    gemm_parallel(matmul_batch_worker, job);
+  else
+    matmul_batch_worker(0, 1, job);
+}
+
+void matmul_batched(int count, int m, int n, int k, fixedpt *a, int lda,
+                    int stride_a, fixedpt *b, int ldb, int stride_b,
+                    fixedpt *c, int ldc, int stride_c) {
+  /*
+  Computes C_i = A_i * B_i + C_i for i < count, where the operands of item
+  i start stride_a, stride_b and stride_c elements after those of item
+  i - 1. stride_b may be 0 to multiply every A_i by the same B.
+  */
+  batch_job job = {count, m, n, k, a, b, c, lda, ldb, ldc,
+                   stride_a, stride_b, stride_c};
+
+  if (a == NULL || b == NULL || c == NULL || count < 0 || stride_a < 0 ||
+      stride_b < 0 || stride_c < 0) {
+    printf("Argument Error : Invalid input arguments to matmul_batched()\n");
+    return;
+  }
+  if (count == 0)
+    return;
+
+  load_profile();
+  job.share_b = stride_b == 0 && count > 1;
+  matmul_batch(&job);
+}
+
+void matmul_batched_ptr(int count, int m, int n, int k, fixedpt **a, int lda,
+                        fixedpt **b, int ldb, fixedpt **c, int ldc) {
+  /* matmul_batched() with the operands of item i at a[i], b[i] and c[i] */
+  batch_job job = {count, m, n, k};
+  int i;
+
+  if (a == NULL || b == NULL || c == NULL || count < 0) {
+    printf(
+        "Argument Error : Invalid input arguments to matmul_batched_ptr()\n");
+    return;
+  }
+  if (count == 0)
+    return;
+
+  job.ap = a;
+  job.bp = b;
+  job.cp = c;
+  job.lda = lda;
+  job.ldb = ldb;
+  job.ldc = ldc;
+  for (i = 1; i < count && b[i] == b[0]; i++)
+    ;
+  job.share_b = count > 1 && i == count;
+  load_profile();
+  matmul_batch(&job);
+}
+/*
+ * Sparse A times dense B, see src/sparse.c. CSR rows are multiplied element
+ * by element. For BSR the kc x nc blocks of B are packed as for matmul(),
+ * with kc rounded to whole GEMM_SPARSE_BK blocks, and the tile kernel only
+ * runs for the blocks of A that are stored: the block at block column q is
+ * a packed GEMM_MR x GEMM_SPARSE_BK panel of A, and the matching B panel
+ * starts q * GEMM_SPARSE_BK rows into the packed one. The stored blocks of
+ * a row at consecutive block columns follow each other in val, so together
+ * they are one deeper packed panel and take a single kernel call.
+ */
+
+static void matmul_csr(int n, const gemm_sparse *sp, fixedpt *b, int ldb,
+                       fixedpt *c, int ldc) {
+  fixedpt sum;
+  int i, j, e;
+
+  for (j = 0; j < n; j++)
+    for (i = 0; i < sp->m; i++) {
+      sum = 0;
+      for (e = sp->ptr[i]; e < sp->ptr[i + 1]; e++)
+        sum = fixedpt_add(sum, fixedpt_mul(sp->val[e], B(sp->idx[e], j)));
+      C(i, j) += sum;
+    }
+}
+
+void matmul_sparse(int m, int n, int k, const gemm_sparse *a, fixedpt *b,
+                   int ldb, fixedpt *c, int ldc) {
+  /*
+  C = A * B + C for a sparse m x k A from gemm_sparse_from_dense().
+  */
+  int bk = GEMM_SPARSE_BK, kb;
+  int i, j, p, pb, kp, jb, jj, ib, r, e, q, run;
+  size_t panel_b;
+  fixedpt *packedB, *blk;
+  int *next;
+  gemm_call call;
+
+  if (a == NULL || b == NULL || c == NULL) {
+    printf("Argument Error : One of the input arguments to matmul_sparse() "
+           "was NULL\n");
+    return;
+  }
+  if (a->m != m || a->k != k) {
+    printf("Argument Error : matmul_sparse() got a sparse A of %dx%d for a "
+           "%dx%d operand\n",
+           a->m, a->k, m, k);
+    return;
+  }
+  if (a->format == GEMM_SPARSE_CSR) {
+    matmul_csr(n, a, b, ldb, c, ldc);
+    return;
+  }
+
+  load_profile();
+  kb = ROUNDUP(kc, GEMM_SPARSE_BK);
+  panel_b =
+      min(ROUNDUP(k, bk), kb) * ROUNDUP(min(n, nc), GEMM_NR) * sizeof(fixedpt);
+  if (default_ws == NULL)
+    default_ws = matmul_workspace_create(0);
+  if (default_ws == NULL ||
+      !matmul_workspace_reserve(
+          default_ws, ROUNDUP(panel_b, GEMM_CACHE_LINE) +
+                          ROUNDUP(a->rows * sizeof(int), GEMM_CACHE_LINE))) {
+    printf("Allocation Error : Could not grow the matmul() workspace\n");
+    return;
+  }
+  matmul_workspace_reset(default_ws);
+  packedB = (fixedpt *)matmul_workspace_alloc(default_ws, panel_b);
+  /* First entry of every block row not multiplied yet in this nc block */
+  next = (int *)matmul_workspace_alloc(default_ws, a->rows * sizeof(int));
+
+  call = (gemm_call)PLAIN_CALL(select_kernel());
+
+  for (j = 0; j < n; j += nc) {
+    jb = min(n - j, nc);
+    memcpy(next, a->ptr, a->rows * sizeof(int));
+    for (p = 0; p < k; p += kb) {
+      pb = min(k - p, kb);
+      kp = ROUNDUP(pb, bk);
+      for (jj = 0; jj < jb; jj += GEMM_NR) {
+        PackMatrixB(min(jb - jj, GEMM_NR), pb, &B(p, j + jj), ldb,
+                    &packedB[jj * kp]);
+        memset(&packedB[jj * kp + pb * GEMM_NR], 0,
+               (kp - pb) * GEMM_NR * sizeof(fixedpt));
+      }
+
+      for (r = 0; r < a->rows; r++) {
+        i = r * GEMM_MR;
+        ib = min(m - i, GEMM_MR);
+        for (e = next[r]; e < a->ptr[r + 1]; e += run) {
+          q = a->idx[e] * bk - p; /* depth of the block in the B panel */
+          if (q >= pb)
+            break;
+          /* Blocks at the following block columns extend the panel */
+          for (run = 1; e + run < a->ptr[r + 1] &&
+                        a->idx[e + run] == a->idx[e] + run &&
+                        q + run * bk < pb;
+               run++)
+            ;
+          blk = &a->val[e * GEMM_MR * bk];
+          for (jj = 0; jj < jb; jj += GEMM_NR)
+            if (ib == GEMM_MR && jb - jj >= GEMM_NR)
+              call.kernel(run * bk, blk, GEMM_MR,
+                          &packedB[jj * kp + q * GEMM_NR], kp, &C(i, j + jj),
+                          ldc);
+            else
+              AddDot_edge(&call, ib, min(jb - jj, GEMM_NR), run * bk, blk,
+                          &packedB[jj * kp + q * GEMM_NR], FIXEDPT_ONE, 0,
+                          &C(i, j + jj), ldc, i, j + jj);
+        }
+        next[r] = e;
+      }
+    }
+  }
+}
+
+void InnerKernel(const gemm_call *call, int m, int n, int k, fixedpt *a,
+                 int lda, fixedpt *b, int ldb, fixedpt *c, int ldc, int row,
+                 int col, int first_time, fixedpt beta, int last,
+                 fixedpt *packedA, fixedpt *packedB, unsigned char *zeroA,
+                 unsigned char *zeroB) {
+  /*
+  packedB keeps the k x n panel of B between calls, so it is only packed
+  for the first mc block of rows (first_time) and reused for the others.
+  zeroA and zeroB are the zero maps of the panels, one flag per panel
+  packed, and the tiles with a zero A or B panel never reach the kernel.
+
+  m and n need not be multiples of GEMM_MR and GEMM_NR: the last panels
+  are zero padded by the packing routines and their tiles go through
+  AddDot_edge(). So do all tiles when the write back scales, i.e. C is
+  updated to alpha * A * B + beta * C instead of C + A * B, and when the
+  epilogue of the call is applied by this, the last kc block. (row, col)
+  is the position of this block in the C of the call, for the epilogue.
+
+  Queued device commands are submitted before every packing step, so the
+  device works on the tiles so far while the CPU packs the next panel.
+  The fringe and scaled tiles of a column panel are computed into up to
+  EDGE_TILES local buffers and stored after one fence for all of them, so
+  the device is not drained for every tile.
+  */
+  int plain = call->alpha == FIXEDPT_ONE && beta == FIXEDPT_ONE &&
+              !(last && call->ep != NULL);
+  fixedpt tiles[EDGE_TILES][GEMM_MR * GEMM_NR];
+  int at[EDGE_TILES]; /* row of C of each buffered tile */
+  int i, j, ib, jb, zero, t, count = 0, queued = 0;
+
+  for (j = 0; j < n; j += GEMM_NR) {
+    jb = min(n - j, GEMM_NR);
+    if (first_time) {
+      simd_ring_submit();
+      zeroB[j / GEMM_NR] =
+          pack_panel_b(call, jb, k, opB(call, 0, j), ldb, &packedB[j * k]);
+    }
+    for (i = 0; i < m; i += GEMM_MR) {
+      ib = min(m - i, GEMM_MR);
+      if (j == 0) {
+        simd_ring_submit();
+        zeroA[i / GEMM_MR] =
+            pack_panel_a(call, ib, k, opA(call, i, 0), lda, &packedA[i * k]);
+      }
+      zero = zeroA[i / GEMM_MR] || zeroB[j / GEMM_NR];
+      if (plain && ib == GEMM_MR && jb == GEMM_NR) {
+        if (!zero) /* else it adds nothing to C */
+          call->kernel(k, &packedA[i * k], GEMM_MR, &packedB[j * k], k,
+                       &C(i, j), ldc);
+      } else if (!(plain && zero)) {
+        memset(tiles[count], 0, sizeof(tiles[count]));
+        if (!zero) {
+          call->kernel(k, &packedA[i * k], GEMM_MR, &packedB[j * k], k,
+                       tiles[count], GEMM_MR);
+          queued = 1;
+        }
+        at[count++] = i;
+      }
+      if (count == EDGE_TILES || (count > 0 && i + GEMM_MR >= m)) {
+        if (queued)
+          simd_ring_fence();
+        for (t = 0; t < count; t++)
+          edge_store(call, min(m - at[t], GEMM_MR), jb, tiles[t], beta, last,
+                     &C(at[t], j), ldc, row + at[t], col + j);
+        count = queued = 0;
+      }
     }
   }
-  return;
 }
 
-void InnerKernel(int m, int n, int k, fixedpt *a, int lda, fixedpt *b, int ldb,
-                 fixedpt *c, int ldc, int first_time) {
+static void edge_store(const gemm_call *call, int m, int n,
+                       const fixedpt *tile, fixedpt beta, int last,
+                       fixedpt *c, int ldc, int row, int col) {
+  /*
+  Writes the top-left m x n corner of a GEMM_MR x GEMM_NR tile back to C,
+  as alpha * tile + beta * C. C is not read when beta is 0. For the last
+  kc block (last) the epilogue of the call is applied to the sum before it
+  is stored, with (row, col) the position of the tile in the C of the call.
+  */
+  fixedpt v;
   int i, j;
-  fixedpt *packedA = (fixedpt *)malloc(m * k * sizeof(fixedpt));
-  fixedpt *packedB = (fixedpt *)malloc(kc * nb * sizeof(fixedpt));
 
-  for (j = 0; j < n; j += 4) {
-    if (first_time)
-      PackMatrixB(k, &B(0, j), ldb, &packedB[j * k]);
-    for (i = 0; i < m; i += 4) {
-      if (j == 0)
-        PackMatrixA(k, &A(i, 0), lda, &packedA[i * k]);
-      AddDot4x4(k, &packedA[i * k], 4, &packedB[j * k], k, &C(i, j), ldc);
+  for (j = 0; j < n; j++)
+    for (i = 0; i < m; i++) {
+      v = tile[j * GEMM_MR + i];
+      if (call->alpha != FIXEDPT_ONE)
+        v = fixedpt_mul(call->alpha, v);
+      if (beta == FIXEDPT_ONE)
+        v += C(i, j);
+      else if (beta != 0)
+        v += fixedpt_mul(beta, C(i, j));
+      C(i, j) = last && call->ep ? epilogue(call, v, row + i, col + j) : v;
     }
+}
+
+void AddDot_edge(const gemm_call *call, int m, int n, int k, fixedpt *a,
+                 fixedpt *b, fixedpt beta, int last, fixedpt *c, int ldc,
+                 int row, int col) {
+  /*
+  Masked tile kernel for one tile of the fringe of C: the full GEMM_MR x
+  GEMM_NR tile is computed from the zero padded panels into a local buffer
+  and its top-left m x n corner stored by edge_store(). k is 0 for a tile
+  whose product is known to be zero, which only scales C. InnerKernel()
+  batches these steps over a panel instead.
+  */
+  fixedpt tile[GEMM_MR * GEMM_NR] = {0};
+
+  if (k > 0) {
+    call->kernel(k, a, GEMM_MR, b, k, tile, GEMM_MR);
+    simd_ring_fence();
   }
+  edge_store(call, m, n, tile, beta, last, c, ldc, row, col);
 }
 
-void PackMatrixA(int k, fixedpt *a, int lda, fixedpt *a_to) {
-  int j;
+/*
+ * The packing routines lay out m <= GEMM_MR rows of A, or n <= GEMM_NR
+ * columns of B, as one panel with the GEMM_MR (GEMM_NR) values of every
+ * k step next to each other. The bounds are constants so the copy loops of
+ * full panels unroll. They return 1 when the panel is all zero, which the
+ * OR of the copied values tells at the cost of one instruction per value.
+ */
+
+int PackMatrixA(int m, int k, fixedpt *a, int lda, fixedpt *a_to) {
+  fixedpt any = 0;
+  int i, j;
+
+  if (m < GEMM_MR) { /* fringe: copy m rows and zero the rest of the panel */
+    for (j = 0; j < k; j++) {
+      for (i = 0; i < GEMM_MR; i++)
+        any |= a_to[i] = i < m ? A(i, j) : 0;
+      a_to += GEMM_MR;
+    }
+    return any == 0;
+  }
+
   for (j = 0; j < k; j++) { /* loop over columns of A */
     fixedpt *a_ij_pntr = &A(0, j);
-    *a_to = *a_ij_pntr;
-    *(a_to + 1) = *(a_ij_pntr + 1);
-    *(a_to + 2) = *(a_ij_pntr + 2);
-    *(a_to + 3) = *(a_ij_pntr + 3);
+    for (i = 0; i < GEMM_MR; i++)
+      any |= a_to[i] = a_ij_pntr[i];
 
-    a_to += 4;
+    a_to += GEMM_MR;
   }
+  return any == 0;
 }
 
-void PackMatrixB(int k, fixedpt *b, int ldb, fixedpt *b_to) {
-  int i;
-  fixedpt *b_i0_pntr = &B(0, 0), *b_i1_pntr = &B(0, 1), *b_i2_pntr = &B(0, 2),
-          *b_i3_pntr = &B(0, 3);
+int PackMatrixB(int n, int k, fixedpt *b, int ldb, fixedpt *b_to) {
+  fixedpt any = 0;
+  int i, j;
+
+  if (n < GEMM_NR) { /* fringe: copy n columns and zero the rest of the panel */
+    for (i = 0; i < k; i++) {
+      for (j = 0; j < GEMM_NR; j++)
+        any |= b_to[j] = j < n ? B(i, j) : 0;
+      b_to += GEMM_NR;
+    }
+    return any == 0;
+  }
 
   for (i = 0; i < k; i++) { /* loop over rows of B */
-    *b_to++ = *b_i0_pntr++;
-    *b_to++ = *b_i1_pntr++;
-    *b_to++ = *b_i2_pntr++;
-    *b_to++ = *b_i3_pntr++;
+    for (j = 0; j < GEMM_NR; j++)
+      any |= b_to[j] = B(i, j);
+    b_to += GEMM_NR;
+  }
+  return any == 0;
+}
+
+int PackMatrixA_T(int m, int k, fixedpt *a, int lda, fixedpt *a_to) {
+  /* PackMatrixA for A stored transposed: row i of op(A) is A_row(i, :) */
+  fixedpt any = 0;
+  int i, j;
+
+  for (i = 0; i < GEMM_MR; i++) /* loop over rows of op(A), read in order */
+    for (j = 0; j < k; j++)
+      any |= a_to[j * GEMM_MR + i] = i < m ? A_row(i, j) : 0;
+  return any == 0;
+}
+
+int PackMatrixB_T(int n, int k, fixedpt *b, int ldb, fixedpt *b_to) {
+  /*
+  PackMatrixB for B stored transposed: the GEMM_NR values of op(B) that a
+  panel holds for every k step are next to each other in B_row(i, :).
+  */
+  fixedpt any = 0;
+  int i, j;
+
+  for (i = 0; i < k; i++) { /* loop over rows of op(B) */
+    for (j = 0; j < GEMM_NR; j++)
+      any |= b_to[j] = j < n ? B_row(i, j) : 0;
+    b_to += GEMM_NR;
   }
+  return any == 0;
 }
 
 /*
@@ -251,3 +1702,185 @@ void AddDot4x4(int k, fixedpt *a, int lda, fixedpt *b, int ldb, fixedpt *c,
   C(3, 2) += c_22_c_32_vreg.d[1];
   C(3, 3) += c_23_c_33_vreg.d[1];
 }
+
+#if GEMM_4X4
+void AddDot4x4_wide(int k, fixedpt *a, int lda, fixedpt *b, int ldb,
+                    fixedpt *c, int ldc) {
+  /*
+  Software variant of AddDot4x4 on the same packed panels. The 16
+  accumulators hold the exact double-width products (fixedpt_acc), so the
+  shift back by FIXEDPT_FBITS and the rounding happen once per element of C
+  when it is written back instead of once per multiply.
+  */
+  fixedpt_acc acc[4][4] = {0};
+  int p, i, j;
+
+  for (p = 0; p < k; p++) {
+    for (j = 0; j < 4; j++)
+      for (i = 0; i < 4; i++)
+        fixedpt_acc_mac(&acc[i][j], a[i], b[j]);
+    a += 4;
+    b += 4;
+  }
+
+  for (j = 0; j < 4; j++)
+    for (i = 0; i < 4; i++)
+      C(i, j) += fixedpt_acc_get(acc[i][j]);
+}
+#endif
+
+void AddDot4x4xK(int k, fixedpt *a, int lda, fixedpt *b, int ldb, fixedpt *c,
+                 int ldc) {
+  /*
+  Same as AddDot4x4, but the device runs the whole k loop and the update of
+  C from one command instead of 14 instructions per iteration.
+  */
+  simd_dot4x4xk(a, b, k, c, ldc);
+}
+
+void AddDot4x4_vregs(int k, fixedpt *a, int lda, fixedpt *b, int ldb,
+                     fixedpt *c, int ldc) {
+  /*
+  AddDot4x4 on the device register file, built for SIMD_LANES-wide
+  vectors. The accumulators stay in device registers for the whole k loop.
+  Argument registers 0, 1 and 2 hold the bases of A, B and the current
+  column of C; the bases of A and B move every 32 steps so that offsets
+  stay below 256.
+  */
+  int p, j, off;
+
+#if SIMD_LANES == 2
+  /*
+  v0 + j : C(0:1, j)    v8 : A(0:1, p)    v10 + j : dup(B(p, j))
+  v4 + j : C(2:3, j)    v9 : A(2:3, p)
+
+  C(0:1, j) and C(2:3, j) are contiguous in column-major order, so the
+  accumulators are loaded from C once and stored back once.
+  14 instructions per k step.
+  */
+  for (j = 0; j < 4; j++) {
+    simd_setbase(2, &C(0, j));
+    simd_vload(j, 2, 0);
+    simd_vload(4 + j, 2, 2);
+  }
+
+  for (p = 0; p < k; p++) {
+    if ((p & 31) == 0) {
+      simd_setbase(0, a + p * 4);
+      simd_setbase(1, b + p * 4);
+    }
+    off = (p & 31) * 4;
+
+    simd_vload(8, 0, off);
+    simd_vload(9, 0, off + 2);
+    for (j = 0; j < 4; j++)
+      simd_vloaddup(10 + j, 1, off + j);
+
+    for (j = 0; j < 4; j++) {
+      simd_vmla(j, 8, 10 + j);
+      simd_vmla(4 + j, 9, 10 + j);
+    }
+  }
+
+  for (j = 0; j < 4; j++) {
+    simd_setbase(2, &C(0, j));
+    simd_vstore(j, 2, 0);
+    simd_vstore(4 + j, 2, 2);
+  }
+#elif SIMD_LANES == 4
+  /*
+  v0 + j : C(0:3, j)    v4 : A(0:3, p)    v5 + j : dup(B(p, j))
+
+  One load covers the whole packed column of A. 9 instructions per k step.
+  */
+  for (j = 0; j < 4; j++) {
+    simd_setbase(2, &C(0, j));
+    simd_vload(j, 2, 0);
+  }
+
+  for (p = 0; p < k; p++) {
+    if ((p & 31) == 0) {
+      simd_setbase(0, a + p * 4);
+      simd_setbase(1, b + p * 4);
+    }
+    off = (p & 31) * 4;
+
+    simd_vload(4, 0, off);
+    for (j = 0; j < 4; j++)
+      simd_vloaddup(5 + j, 1, off + j);
+    for (j = 0; j < 4; j++)
+      simd_vmla(j, 4, 5 + j);
+  }
+
+  for (j = 0; j < 4; j++) {
+    simd_setbase(2, &C(0, j));
+    simd_vstore(j, 2, 0);
+  }
+#elif SIMD_LANES == 8
+  /*
+  v0 : C(0:3, 0:1)    v2 : rep(A(0:3, p))    v3 : dup(B(p, 0:1))
+  v1 : C(0:3, 2:3)                           v4 : dup(B(p, 2:3))
+
+  Two columns of C share a vector, which only matches C in memory when
+  ldc is 4, so the tile is accumulated from zero into a local buffer and
+  added to C by the CPU. 5 instructions per k step.
+  */
+  fixedpt tile[16];
+  int i;
+
+  simd_vzero(0);
+  simd_vzero(1);
+
+  for (p = 0; p < k; p++) {
+    if ((p & 31) == 0) {
+      simd_setbase(0, a + p * 4);
+      simd_setbase(1, b + p * 4);
+    }
+    off = (p & 31) * 4;
+
+    simd_vloadrep(2, 0, off);
+    simd_vloaddup(3, 1, off);
+    simd_vloaddup(4, 1, off + 2);
+    simd_vmla(0, 2, 3);
+    simd_vmla(1, 2, 4);
+  }
+
+  simd_setbase(2, tile);
+  simd_vstore(0, 2, 0);
+  simd_vstore(1, 2, 8);
+  simd_ring_fence();
+  for (j = 0; j < 4; j++)
+    for (i = 0; i < 4; i++)
+      C(i, j) += tile[j * 4 + i];
+#endif
+}
+
+/*
+ * CPU tile kernels, one per register block shape, generated from a single
+ * template. The MR x NR accumulators have constant bounds so the compiler
+ * keeps as many as fit in registers; every product is rounded like the
+ * SIMD device does.
+ */
+#define GEMM_TILE_KERNEL(MR, NR)                                               \
+  void AddDot##MR##x##NR##_cpu(int k, fixedpt *a, int lda, fixedpt *b,         \
+                               int ldb, fixedpt *c, int ldc) {                 \
+    fixedpt acc[MR][NR] = {{0}};                                               \
+    int p, i, j;                                                               \
+                                                                               \
+    for (p = 0; p < k; p++) {                                                  \
+      for (j = 0; j < NR; j++)                                                 \
+        for (i = 0; i < MR; i++)                                               \
+          acc[i][j] = fixedpt_add(acc[i][j], fixedpt_mul(a[i], b[j]));         \
+      a += MR;                                                                 \
+      b += NR;                                                                 \
+    }                                                                          \
+                                                                               \
+    for (j = 0; j < NR; j++)                                                   \
+      for (i = 0; i < MR; i++)                                                 \
+        C(i, j) += acc[i][j];                                                  \
+  }
+
+GEMM_TILE_KERNEL(4, 4)
+GEMM_TILE_KERNEL(8, 4)
+GEMM_TILE_KERNEL(4, 8)
+GEMM_TILE_KERNEL(8, 8)
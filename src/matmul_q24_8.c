@@ -0,0 +1,129 @@
+#include <gemm.h>
+
+/*
+ * matmul for 24.8 fixed point numbers stored in 32 bits, next to the
+ * fixedpt one of matmul.c (56.8 in 64 bits by default). It is in every
+ * build, whatever FIXEDPT_BITS is; matmul_q56_8() is only there when fixedpt
+ * is 56.8.
+ *
+ * Half the bytes per element means twice the values per cache line, so the
+ * panels are packed kc * 2 deep: they take as many bytes as the 64-bit
+ * ones with the block sizes of gemm_get_params(). The tile kernel multiplies
+ * 32x32->64, which is a mul/mulh pair on rv32 instead of the software
+ * 128-bit product of fixedpt_mul(), keeps the exact sum of a block in int64
+ * and shifts it back to 24.8 once per block, rounding to nearest.
+ *
+ * The exact sums must fit in int64, i.e. |a * b| * kc * 2 < 2^63, which
+ * holds for operands below 32768.0 in magnitude up to kc = 2^15. This path
+ * runs on the CPU of the caller only.
+ */
+
+#define min(i, j) ((i) < (j) ? (i) : (j))
+
+#define Q24_8_FBITS 8
+
+static matmul_workspace *q24_8_ws;
+
+static void pack_a_q24_8(int m, int k, const fixedpt_q24_8 *a, int lda,
+                         fixedpt_q24_8 *a_to) {
+  /* m <= GEMM_MR rows of A as one zero padded panel, see PackMatrixA() */
+  int i, j;
+
+  for (j = 0; j < k; j++, a_to += GEMM_MR)
+    for (i = 0; i < GEMM_MR; i++)
+      a_to[i] = i < m ? A(i, j) : 0;
+}
+
+static void pack_b_q24_8(int n, int k, const fixedpt_q24_8 *b, int ldb,
+                         fixedpt_q24_8 *b_to) {
+  /* n <= GEMM_NR columns of B as one zero padded panel, see PackMatrixB() */
+  int i, j;
+
+  for (i = 0; i < k; i++, b_to += GEMM_NR)
+    for (j = 0; j < GEMM_NR; j++)
+      b_to[j] = j < n ? B(i, j) : 0;
+}
+
+static void AddDot_q24_8(int m, int n, int k, const fixedpt_q24_8 *a,
+                         const fixedpt_q24_8 *b, fixedpt_q24_8 *c, int ldc) {
+  /*
+  One GEMM_MR x GEMM_NR tile from packed panels, of which the top-left
+  m x n corner is added to C. The accumulators are int64 and the products
+  exact, so the result of a block is rounded only once.
+  */
+  int64_t acc[GEMM_MR * GEMM_NR] = {0};
+  int i, j, p;
+
+  for (p = 0; p < k; p++, a += GEMM_MR, b += GEMM_NR)
+    for (j = 0; j < GEMM_NR; j++)
+      for (i = 0; i < GEMM_MR; i++)
+        acc[j * GEMM_MR + i] += (int64_t)a[i] * b[j];
+
+  for (j = 0; j < n; j++)
+    for (i = 0; i < m; i++)
+      C(i, j) += (fixedpt_q24_8)((acc[j * GEMM_MR + i] +
+                                  (1 << (Q24_8_FBITS - 1))) >>
+                                 Q24_8_FBITS);
+}
+
+void matmul_q24_8(int m, int n, int k, const fixedpt_q24_8 *a, int lda,
+                  const fixedpt_q24_8 *b, int ldb, fixedpt_q24_8 *c,
+                  int ldc) {
+  /*
+  Same as matmul(), C = A * B + C, for 24.8 operands. The blocking is the
+  one of matmul() with kc doubled, see the top of this file.
+  */
+  gemm_params params;
+  fixedpt_q24_8 *packedA, *packedB;
+  int i, j, p, ib, jb, pb, jj, ii, mb, kb, nb;
+  size_t panel_a, panel_b;
+
+  if (a == NULL || b == NULL || c == NULL) {
+    printf("Argument Error : One of the input arguments to matmul_q24_8() "
+           "was NULL\n");
+    return;
+  }
+  if (m < 1 || n < 1 || k < 1)
+    return;
+
+  gemm_get_params(&params);
+  mb = params.mc;
+  kb = params.kc * 2;
+  nb = params.nc;
+  panel_a = ROUNDUP(min(m, mb), GEMM_MR) * min(k, kb) * sizeof(fixedpt_q24_8);
+  panel_b = min(k, kb) * ROUNDUP(min(n, nb), GEMM_NR) * sizeof(fixedpt_q24_8);
+
+  if (q24_8_ws == NULL)
+    q24_8_ws = matmul_workspace_create(0);
+  if (q24_8_ws == NULL ||
+      !matmul_workspace_reserve(q24_8_ws,
+                                ROUNDUP(panel_a, GEMM_CACHE_LINE) +
+                                    ROUNDUP(panel_b, GEMM_CACHE_LINE))) {
+    printf("Allocation Error : Could not grow the matmul_q24_8() workspace\n");
+    return;
+  }
+  matmul_workspace_reset(q24_8_ws);
+  packedA = (fixedpt_q24_8 *)matmul_workspace_alloc(q24_8_ws, panel_a);
+  packedB = (fixedpt_q24_8 *)matmul_workspace_alloc(q24_8_ws, panel_b);
+
+  for (j = 0; j < n; j += nb) {
+    jb = min(n - j, nb);
+    for (p = 0; p < k; p += kb) {
+      pb = min(k - p, kb);
+      for (jj = 0; jj < jb; jj += GEMM_NR)
+        pack_b_q24_8(min(jb - jj, GEMM_NR), pb, &B(p, j + jj), ldb,
+                     &packedB[jj * pb]);
+      for (i = 0; i < m; i += mb) {
+        ib = min(m - i, mb);
+        for (ii = 0; ii < ib; ii += GEMM_MR)
+          pack_a_q24_8(min(ib - ii, GEMM_MR), pb, &A(i + ii, p), lda,
+                       &packedA[ii * pb]);
+        for (jj = 0; jj < jb; jj += GEMM_NR)
+          for (ii = 0; ii < ib; ii += GEMM_MR)
+            AddDot_q24_8(min(ib - ii, GEMM_MR), min(jb - jj, GEMM_NR), pb,
+                         &packedA[ii * pb], &packedB[jj * pb],
+                         &C(i + ii, j + jj), ldc);
+      }
+    }
+  }
+}
@@ -0,0 +1,236 @@
+#include <gemm.h>
+
+/*
+ * Quantized matmul: int8 or int16 operands, int32 (int8) or int64 (int16)
+ * accumulators and fixedpt output. The blocks are walked by the loops of
+ * matmul(), see gemm_blocks(), but the panels hold the raw 1 or 2 byte
+ * elements, so a block of A or B moves 8 (4) times fewer bytes than its
+ * fixedpt counterpart.
+ *
+ * The zero points are not subtracted while packing, which would widen the
+ * elements. For a kc block of depth k the tile kernel computes the raw
+ * sum(a * b) and the packing routines the row sums of A and the column sums
+ * of B, from which
+ *
+ *   sum((a - za) * (b - zb)) = sum(a * b) - zb * sum(a) - za * sum(b)
+ *                              + k * za * zb
+ *
+ * and the write back adds scale_a * scale_b * that to C, rounded to a
+ * fixedpt. An int8 product is at most 2^14, so int32 holds the raw sums of
+ * any kc below 2^17. An int16 product is up to 2^30 and two of them already
+ * overflow int32, so int16 tiles accumulate in int64. The row and column
+ * sums are int64 for both types. The real value of a block must be below
+ * 2^31 for the requantization.
+ *
+ * int8 4x4 tiles go to the QDOT4X4XK command of the SIMD device when it has
+ * one, which accumulates in int32. This path runs on the CPU of the caller
+ * only.
+ */
+
+#define min(i, j) ((i) < (j) ? (i) : (j))
+
+/* Bits to drop from scale_a * scale_b * sum to get a fixedpt */
+#define QSHIFT (2 * GEMM_QSCALE_FBITS - FIXEDPT_FBITS)
+
+static matmul_workspace *quant_ws;
+
+/*
+ * Packing routines and tile kernel for one element type T, with the layout
+ * of PackMatrixA and PackMatrixB. The fringe panels are zero padded, which
+ * adds nothing to the sums. sum gets one entry per row (column) packed.
+ * The tile kernel sums the products of a tile in ACC.
+ */
+#define GEMM_QUANT_TYPE(T, ACC)                                                \
+  static void qpack_a_##T(int m, int k, const void *src, int lda, void *dst,  \
+                          int64_t *sum) {                                      \
+    const T *a = (const T *)src;                                               \
+    T *a_to = (T *)dst;                                                        \
+    int i, j;                                                                  \
+                                                                               \
+    for (i = 0; i < m; i++)                                                    \
+      sum[i] = 0;                                                              \
+    for (j = 0; j < k; j++, a_to += GEMM_MR)                                   \
+      for (i = 0; i < GEMM_MR; i++) {                                          \
+        a_to[i] = i < m ? A(i, j) : 0;                                         \
+        if (i < m)                                                             \
+          sum[i] += a_to[i];                                                   \
+      }                                                                        \
+  }                                                                            \
+                                                                               \
+  static void qpack_b_##T(int n, int k, const void *src, int ldb, void *dst,  \
+                          int64_t *sum) {                                      \
+    const T *b = (const T *)src;                                               \
+    T *b_to = (T *)dst;                                                        \
+    int i, j;                                                                  \
+                                                                               \
+    for (j = 0; j < n; j++)                                                    \
+      sum[j] = 0;                                                              \
+    for (i = 0; i < k; i++, b_to += GEMM_NR)                                   \
+      for (j = 0; j < GEMM_NR; j++) {                                          \
+        b_to[j] = j < n ? B(i, j) : 0;                                         \
+        if (j < n)                                                             \
+          sum[j] += b_to[j];                                                   \
+      }                                                                        \
+  }                                                                            \
+                                                                               \
+  static void qtile_##T(int k, const void *pa, const void *pb,                \
+                        int64_t *acc) {                                        \
+    const T *a = (const T *)pa, *b = (const T *)pb;                            \
+    ACC sum[GEMM_MR * GEMM_NR] = {0};                                          \
+    int i, j, p;                                                               \
+                                                                               \
+    for (p = 0; p < k; p++, a += GEMM_MR, b += GEMM_NR)                        \
+      for (j = 0; j < GEMM_NR; j++)                                            \
+        for (i = 0; i < GEMM_MR; i++)                                          \
+          sum[j * GEMM_MR + i] += (ACC)a[i] * b[j];                            \
+    for (i = 0; i < GEMM_MR * GEMM_NR; i++)                                    \
+      acc[i] += sum[i];                                                        \
+  }
+
+GEMM_QUANT_TYPE(int8_t, int32_t)
+GEMM_QUANT_TYPE(int16_t, int64_t)
+
+typedef void (*qpack_t)(int, int, const void *, int, void *, int64_t *);
+typedef void (*qtile_t)(int, const void *, const void *, int64_t *);
+
+static const struct {
+  int bytes;
+  qpack_t pack_a, pack_b;
+  qtile_t tile;
+} qtypes[] = {
+    [GEMM_QINT8] = {1, qpack_a_int8_t, qpack_b_int8_t, qtile_int8_t},
+    [GEMM_QINT16] = {2, qpack_a_int16_t, qpack_b_int16_t, qtile_int16_t},
+};
+
+static void quant_write_back(int m, int n, int k, const int64_t *acc,
+                             const int64_t *row_sum, const int64_t *col_sum,
+                             const gemm_qmatrix *a, const gemm_qmatrix *b,
+                             int j0, fixedpt *c, int ldc) {
+  /*
+  Requantizes the top-left m x n corner of a tile whose first column is
+  column j0 of C, and adds it to C.
+  */
+  int64_t za = a->zero[0], zb, scale, v;
+  int i, j, jb;
+
+  for (j = 0; j < n; j++) {
+    jb = b->per_column ? j0 + j : 0;
+    zb = b->zero[jb];
+    scale = (int64_t)a->scale[0] * b->scale[jb];
+    for (i = 0; i < m; i++) {
+      v = acc[j * GEMM_MR + i] - zb * row_sum[i] - za * col_sum[j] +
+          k * za * zb;
+      C(i, j) += (fixedpt)((v * scale + ((int64_t)1 << (QSHIFT - 1))) >>
+                           QSHIFT);
+    }
+  }
+}
+
+/* Operands and panels of one matmul_quant() call, for quant_block() */
+typedef struct {
+  const gemm_qmatrix *a, *b;
+  fixedpt *c;
+  int ldc, bytes, device;
+  char *packedA, *packedB;
+  int64_t *row_sum, *col_sum;
+} quant_job;
+
+static void quant_block(void *arg, int i, int j, int p, int ib, int jb,
+                        int pb, int first) {
+  /* One block of gemm_blocks(): packs it and adds its tiles to C */
+  quant_job *job = (quant_job *)arg;
+  const gemm_qmatrix *a = job->a, *b = job->b;
+  int bytes = job->bytes, ldc = job->ldc, ii, jj, e;
+  char *packedA = job->packedA, *packedB = job->packedB;
+  fixedpt *c = job->c;
+  int64_t acc[GEMM_MR * GEMM_NR];
+  int32_t dev[GEMM_MR * GEMM_NR];
+
+  if (first)
+    for (jj = 0; jj < jb; jj += GEMM_NR)
+      qtypes[a->type].pack_b(
+          min(jb - jj, GEMM_NR), pb,
+          (const char *)b->data + ((size_t)(j + jj) * b->ld + p) * bytes,
+          b->ld, packedB + (size_t)jj * pb * bytes, &job->col_sum[jj]);
+  for (ii = 0; ii < ib; ii += GEMM_MR)
+    qtypes[a->type].pack_a(
+        min(ib - ii, GEMM_MR), pb,
+        (const char *)a->data + ((size_t)p * a->ld + i + ii) * bytes, a->ld,
+        packedA + (size_t)ii * pb * bytes, &job->row_sum[ii]);
+
+  for (jj = 0; jj < jb; jj += GEMM_NR)
+    for (ii = 0; ii < ib; ii += GEMM_MR) {
+      memset(acc, 0, sizeof(acc));
+      if (job->device) {
+        memset(dev, 0, sizeof(dev));
+        simd_qdot4x4xk((const int8_t *)packedA + (size_t)ii * pb,
+                       (const int8_t *)packedB + (size_t)jj * pb, pb, dev,
+                       GEMM_MR);
+        for (e = 0; e < GEMM_MR * GEMM_NR; e++)
+          acc[e] = dev[e];
+      } else
+        qtypes[a->type].tile(pb, packedA + (size_t)ii * pb * bytes,
+                             packedB + (size_t)jj * pb * bytes, acc);
+      quant_write_back(min(ib - ii, GEMM_MR), min(jb - jj, GEMM_NR), pb, acc,
+                       &job->row_sum[ii], &job->col_sum[jj], a, b, j + jj,
+                       &C(i + ii, j + jj), ldc);
+    }
+}
+
+void matmul_quant(int m, int n, int k, const gemm_qmatrix *a,
+                  const gemm_qmatrix *b, fixedpt *c, int ldc) {
+  /*
+  C = real(A) * real(B) + C for quantized A (m x k) and B (k x n), see
+  gemm_qmatrix. A and B must have the same element type, and only B may
+  be quantized per column.
+  */
+  gemm_params params;
+  quant_job job = {a, b, c, ldc};
+  size_t panel_a, panel_b, sums;
+
+  if (a == NULL || b == NULL || c == NULL || a->data == NULL ||
+      b->data == NULL || a->scale == NULL || b->scale == NULL ||
+      a->zero == NULL || b->zero == NULL) {
+    printf("Argument Error : One of the input arguments to matmul_quant() "
+           "was NULL\n");
+    return;
+  }
+  if (a->type != b->type ||
+      (a->type != GEMM_QINT8 && a->type != GEMM_QINT16) || a->per_column) {
+    printf("Argument Error : matmul_quant() takes A and B of the same type, "
+           "and A per tensor\n");
+    return;
+  }
+  if (m < 1 || n < 1 || k < 1)
+    return;
+
+  gemm_get_params(&params);
+  job.bytes = qtypes[a->type].bytes;
+  panel_a =
+      ROUNDUP(min(m, params.mc), GEMM_MR) * min(k, params.kc) * job.bytes;
+  panel_b =
+      min(k, params.kc) * ROUNDUP(min(n, params.nc), GEMM_NR) * job.bytes;
+
+  if (quant_ws == NULL)
+    quant_ws = matmul_workspace_create(0);
+  sums = ROUNDUP(params.mc * sizeof(int64_t), GEMM_CACHE_LINE) +
+         ROUNDUP(params.nc * sizeof(int64_t), GEMM_CACHE_LINE);
+  if (quant_ws == NULL ||
+      !matmul_workspace_reserve(quant_ws,
+                                ROUNDUP(panel_a, GEMM_CACHE_LINE) +
+                                    ROUNDUP(panel_b, GEMM_CACHE_LINE) + sums)) {
+    printf("Allocation Error : Could not grow the matmul_quant() workspace\n");
+    return;
+  }
+  matmul_workspace_reset(quant_ws);
+  job.packedA = (char *)matmul_workspace_alloc(quant_ws, panel_a);
+  job.packedB = (char *)matmul_workspace_alloc(quant_ws, panel_b);
+  job.row_sum = (int64_t *)matmul_workspace_alloc(quant_ws,
+                                                  params.mc * sizeof(int64_t));
+  job.col_sum = (int64_t *)matmul_workspace_alloc(quant_ws,
+                                                  params.nc * sizeof(int64_t));
+  job.device = GEMM_MR == 4 && GEMM_NR == 4 && job.bytes == 1 &&
+               simd_has(SIMD_CAP_QDOT4X4XK);
+
+  gemm_blocks(m, n, k, quant_block, &job);
+}
@@ -84,31 +84,3 @@ void matmul_col(int m, int n, int k, fixedpt *a, int lda, fixedpt *b, int ldb,
   }
   return;
 }
-
-int main() {
-
-  int m = 20;
-  int n = 20;
-  int k = 20;
-
-  fixedpt *A = (fixedpt *)malloc(m * k * sizeof(fixedpt)); // A = (m,k)
-  fixedpt *B = (fixedpt *)malloc(k * n * sizeof(fixedpt)); // B = (k,n)
-  fixedpt *C = (fixedpt *)malloc(m * n * sizeof(fixedpt)); // C = (m,n)
-  fixedpt *D = (fixedpt *)malloc(m * n * sizeof(fixedpt)); // D = (m,n)
-
-  random_init(m, k, A, m, 0);
-  random_init(k, n, B, k, 0);
-
-  matmul_row(m, n, k, A, m, B, k, C, m);
-
-  random_init(m, k, A, m, 1);
-  random_init(k, n, B, k, 1);
-
-  matmul_col(m, n, k, A, m, B, k, D, m);
-
-  free(A);
-  free(B);
-  free(C);
-  free(D);
-  return 0;
-}
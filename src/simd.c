@@ -0,0 +1,368 @@
+#include <gemm.h>
+
+/* Driver wrappers for the extended commands of the virtual SIMD device */
+
+int simd_has(uint32_t cap) { return (simd_inl(SIMD_CAP) & cap) == cap; }
+
+void simd_dot4x4xk(fixedpt *a, fixedpt *b, int k, fixedpt *c, int ldc) {
+  /*
+  C(0:3, 0:3) += A * B for a packed 4 x k panel of A and a packed k x 4
+  panel of B (the layout of PackMatrixA and PackMatrixB) in one command.
+  */
+  simd_arg(0, (uintptr_t)a);
+  simd_arg(1, (uintptr_t)b);
+  simd_arg(2, (uintptr_t)k);
+  simd_arg(3, (uintptr_t)c);
+  simd_arg(4, (uintptr_t)ldc);
+  simd_cmd(SIMD_INSN(SIMD_OP_DOT4X4XK, 0, 0, 0));
+}
+
+void simd_qdot4x4xk(const int8_t *a, const int8_t *b, int k, int32_t *c,
+                    int ldc) {
+  /*
+  Integer DOT4X4XK: C(0:3, 0:3) += A * B in int32 for packed panels of
+  int8 elements, see matmul_quant(). The sums are exact for k < 2^17.
+  */
+  simd_arg(0, (uintptr_t)a);
+  simd_arg(1, (uintptr_t)b);
+  simd_arg(2, (uintptr_t)k);
+  simd_arg(3, (uintptr_t)c);
+  simd_arg(4, (uintptr_t)ldc);
+  simd_cmd(SIMD_INSN(SIMD_OP_QDOT4X4XK, 0, 0, 0));
+}
+
+/*
+ * Descriptor ring. ring_tail counts the descriptors written so far,
+ * ring_submitted the ones the device has been told about and ring_head the
+ * last head read back from the device. All are free running and wrap
+ * around, slots are taken modulo SIMD_RING_ENTRIES.
+ */
+
+static simd_desc ring[SIMD_RING_ENTRIES]
+    __attribute__((aligned(GEMM_CACHE_LINE)));
+static uint32_t ring_tail, ring_submitted, ring_head;
+int simd_ring_on = 0;
+
+void simd_ring_enable(void) {
+  if (simd_ring_on)
+    return;
+  /* Writing the base resets the device's head and tail to 0 */
+  simd_outl(SIMD_RING_BASE, (uintptr_t)ring);
+  simd_outl(SIMD_RING_SIZE, SIMD_RING_ENTRIES);
+  ring_tail = ring_submitted = ring_head = 0;
+  simd_ring_on = 1;
+}
+
+void simd_ring_disable(void) {
+  simd_ring_fence();
+  simd_ring_on = 0;
+}
+
+void simd_ring_push(uint32_t insn, uintptr_t data) {
+  /* Full ring: hand everything to the device and wait for a free slot */
+  if (ring_tail - ring_head >= SIMD_RING_ENTRIES)
+    simd_ring_wait(simd_ring_submit() - SIMD_RING_ENTRIES + 1);
+
+  simd_desc *d = &ring[ring_tail % SIMD_RING_ENTRIES];
+  d->insn = insn;
+  d->data = data;
+  ring_tail++;
+}
+
+uint32_t simd_ring_submit(void) {
+  /* Rings the doorbell if anything is pending, returns the fence */
+  if (simd_ring_on && ring_submitted != ring_tail) {
+    simd_outl(SIMD_RING_TAIL, ring_tail);
+    ring_submitted = ring_tail;
+  }
+  return ring_submitted;
+}
+
+void simd_ring_wait(uint32_t fence) {
+  if (!simd_ring_on)
+    return;
+  while ((int32_t)(ring_head - fence) < 0)
+    ring_head = (uint32_t)simd_inl(SIMD_RING_HEAD);
+}
+
+void simd_ring_fence(void) { simd_ring_wait(simd_ring_submit()); }
+
+#ifdef __ISA_NATIVE__
+/*
+ * Software model of the device for native builds. It decodes the same
+ * register writes as the hardware, so the driver above runs unchanged, and
+ * also implements the original abstract-machine instructions. Every
+ * transaction is accounted for, and simd_model_report() prints a summary
+ * with an estimate of the cycles spent from the latency model below.
+ */
+
+/* Capabilities the modelled device advertises */
+#ifndef SIMD_MODEL_CAPS
+#define SIMD_MODEL_CAPS                                                        \
+  (SIMD_CAP_DOT4X4XK | SIMD_CAP_VREGS | SIMD_CAP_VL4 | SIMD_CAP_VL8 |          \
+   SIMD_CAP_RING | SIMD_CAP_QDOT4X4XK)
+#endif
+
+/* Latency model, in cycles */
+#ifndef SIMD_MODEL_MMIO_CYCLES
+#define SIMD_MODEL_MMIO_CYCLES 10 /* one bus read or write */
+#endif
+#ifndef SIMD_MODEL_ISSUE_CYCLES
+#define SIMD_MODEL_ISSUE_CYCLES 1 /* decoding one instruction */
+#endif
+#ifndef SIMD_MODEL_MAC_CYCLES
+#define SIMD_MODEL_MAC_CYCLES 4 /* one lane multiply-add */
+#endif
+#ifndef SIMD_MODEL_WORD_CYCLES
+#define SIMD_MODEL_WORD_CYCLES 2 /* one fixedpt from or to memory */
+#endif
+
+enum {
+  M_SETZERO,
+  M_LOAD,
+  M_LOADDUP,
+  M_MUL_ADD,
+  M_DOT4X4XK,
+  M_VZERO,
+  M_VLOAD,
+  M_VLOADDUP,
+  M_VLOADREP,
+  M_VMLA,
+  M_VSTORE,
+  M_SETARG,
+  M_QDOT4X4XK,
+  M_NR_OPS
+};
+
+static const char *model_op_names[M_NR_OPS] = {
+    "setzero", "load",    "loaddup",  "mul_add", "dot4x4xk", "vzero",
+    "vload",   "vloaddup", "vloadrep", "vmla",    "vstore",   "setarg",
+    "qdot4x4xk"};
+
+static struct {
+  uint64_t ops[M_NR_OPS];
+  uint64_t mmio_writes, mmio_reads;
+  uint64_t bytes; /* moved between the device and memory */
+  uint64_t macs;
+  uint64_t doorbells, overlapped, stalled;
+} model_stat;
+
+static uintptr_t model_args[SIMD_NR_ARGS];
+static fixedpt model_vregs[SIMD_NR_VREGS][SIMD_MAX_LANES];
+
+static void model_account(int op, int words, int macs) {
+  model_stat.ops[op]++;
+  model_stat.bytes += words * sizeof(fixedpt);
+  model_stat.macs += macs;
+}
+
+/* The original instructions operate on 2-lane v2df_t vectors in memory */
+
+void simd_setzero(uintptr_t dst1, uintptr_t dst2, uintptr_t dst3) {
+  uintptr_t dst[3] = {dst1, dst2, dst3};
+  int i;
+
+  model_stat.mmio_writes++;
+  for (i = 0; i < 3; i++)
+    if (dst[i]) {
+      ((fixedpt *)dst[i])[0] = ((fixedpt *)dst[i])[1] = 0;
+      model_account(M_SETZERO, 2, 0);
+    }
+}
+
+void simd_load(uintptr_t dst, uintptr_t src) {
+  model_stat.mmio_writes++;
+  model_account(M_LOAD, 4, 0);
+  ((fixedpt *)dst)[0] = ((fixedpt *)src)[0];
+  ((fixedpt *)dst)[1] = ((fixedpt *)src)[1];
+}
+
+void simd_loaddup(uintptr_t dst, uintptr_t src) {
+  model_stat.mmio_writes++;
+  model_account(M_LOADDUP, 3, 0);
+  ((fixedpt *)dst)[0] = ((fixedpt *)dst)[1] = ((fixedpt *)src)[0];
+}
+
+void simd_mul_add(uintptr_t dst, uintptr_t src2, uintptr_t src1) {
+  fixedpt *c = (fixedpt *)dst, *a = (fixedpt *)src2, *b = (fixedpt *)src1;
+
+  model_stat.mmio_writes++;
+  model_account(M_MUL_ADD, 8, 2);
+  c[0] = fixedpt_add(c[0], fixedpt_mul(a[0], b[0]));
+  c[1] = fixedpt_add(c[1], fixedpt_mul(a[1], b[1]));
+}
+
+static void model_dot4x4xk(void) {
+  fixedpt *a = (fixedpt *)model_args[0], *b = (fixedpt *)model_args[1];
+  int k = (int)model_args[2];
+  fixedpt *c = (fixedpt *)model_args[3];
+  int ldc = (int)model_args[4];
+  int i, j, p;
+
+  model_account(M_DOT4X4XK, 8 * k + 32, 16 * k);
+  for (j = 0; j < 4; j++)
+    for (i = 0; i < 4; i++) {
+      fixedpt sum = 0;
+      for (p = 0; p < k; p++)
+        sum = fixedpt_add(sum, fixedpt_mul(a[p * 4 + i], b[p * 4 + j]));
+      C(i, j) += sum;
+    }
+}
+
+static void model_qdot4x4xk(void) {
+  const int8_t *a = (const int8_t *)model_args[0];
+  const int8_t *b = (const int8_t *)model_args[1];
+  int k = (int)model_args[2];
+  int32_t *c = (int32_t *)model_args[3];
+  int ldc = (int)model_args[4];
+  int i, j, p;
+
+  model_account(M_QDOT4X4XK, 0, 16 * k);
+  model_stat.bytes += 8 * k + 32 * sizeof(int32_t);
+  for (j = 0; j < 4; j++)
+    for (i = 0; i < 4; i++) {
+      int32_t sum = 0;
+      for (p = 0; p < k; p++)
+        sum += a[p * 4 + i] * b[p * 4 + j];
+      C(i, j) += sum;
+    }
+}
+
+static void model_exec(uint32_t insn) {
+  int op = insn >> 24, dst = (insn >> 16) & 0xff, src2 = (insn >> 8) & 0xff,
+      src1 = insn & 0xff, i;
+  int lanes = 2 << ((op >> 4) & 0x3);
+  fixedpt *vd = model_vregs[dst % SIMD_NR_VREGS];
+  fixedpt *mem = (fixedpt *)model_args[src2 % SIMD_NR_ARGS] + src1;
+
+  if (op != SIMD_OP_DOT4X4XK && op != SIMD_OP_QDOT4X4XK)
+    op &= ~0x30; /* strip SIMD_VL */
+
+  switch (op) {
+  case SIMD_OP_DOT4X4XK:
+    model_dot4x4xk();
+    break;
+  case SIMD_OP_QDOT4X4XK:
+    model_qdot4x4xk();
+    break;
+  case SIMD_OP_VZERO:
+    model_account(M_VZERO, 0, 0);
+    for (i = 0; i < lanes; i++)
+      vd[i] = 0;
+    break;
+  case SIMD_OP_VLOAD:
+    model_account(M_VLOAD, lanes, 0);
+    for (i = 0; i < lanes; i++)
+      vd[i] = mem[i];
+    break;
+  case SIMD_OP_VLOADDUP:
+    model_account(M_VLOADDUP, (lanes + 3) / 4, 0);
+    for (i = 0; i < lanes; i++)
+      vd[i] = mem[i / 4];
+    break;
+  case SIMD_OP_VLOADREP:
+    model_account(M_VLOADREP, lanes < 4 ? lanes : 4, 0);
+    for (i = 0; i < lanes; i++)
+      vd[i] = mem[i % 4];
+    break;
+  case SIMD_OP_VMLA:
+    model_account(M_VMLA, 0, lanes);
+    for (i = 0; i < lanes; i++)
+      vd[i] = fixedpt_add(
+          vd[i], fixedpt_mul(model_vregs[src1 % SIMD_NR_VREGS][i],
+                             model_vregs[src2 % SIMD_NR_VREGS][i]));
+    break;
+  case SIMD_OP_VSTORE:
+    model_account(M_VSTORE, lanes, 0);
+    for (i = 0; i < lanes; i++)
+      mem[i] = vd[i];
+    break;
+  default:
+    printf("simd model: unknown instruction 0x%x\n", insn);
+    halt(1);
+  }
+}
+
+/*
+ * The model runs the ring one doorbell behind: a doorbell executes what
+ * the previous doorbells submitted, as if the device had worked on it while
+ * the CPU was preparing the next batch, and only a poll of the head that
+ * finds pending work makes the CPU wait for the rest.
+ */
+static simd_desc *model_ring;
+static uint32_t model_ring_size, model_head, model_tail;
+
+static void model_ring_run(uint32_t until) {
+  for (; model_head != until; model_head++) {
+    simd_desc *d = &model_ring[model_head % model_ring_size];
+    model_stat.bytes += sizeof(simd_desc);
+    if ((d->insn >> 24) == SIMD_OP_SETARG) {
+      model_stat.ops[M_SETARG]++;
+      model_args[((d->insn >> 16) & 0xff) % SIMD_NR_ARGS] = d->data;
+    } else
+      model_exec(d->insn);
+  }
+}
+
+void simd_outl(uintptr_t addr, uintptr_t data) {
+  model_stat.mmio_writes++;
+  if (addr == SIMD_CMD)
+    model_exec((uint32_t)data);
+  else if (addr >= SIMD_ARG(0) && addr < SIMD_ARG(SIMD_NR_ARGS))
+    model_args[(addr - SIMD_ARG(0)) / 4] = data;
+  else if (addr == SIMD_RING_BASE) {
+    model_ring = (simd_desc *)data;
+    model_head = model_tail = 0;
+  } else if (addr == SIMD_RING_SIZE)
+    model_ring_size = (uint32_t)data;
+  else if (addr == SIMD_RING_TAIL) {
+    model_stat.doorbells++;
+    model_stat.overlapped += model_tail - model_head;
+    model_ring_run(model_tail);
+    model_tail = (uint32_t)data;
+  }
+}
+
+uintptr_t simd_inl(uintptr_t addr) {
+  model_stat.mmio_reads++;
+  if (addr == SIMD_CAP)
+    return SIMD_MODEL_CAPS;
+  if (addr == SIMD_RING_HEAD) {
+    model_stat.stalled += model_tail - model_head;
+    model_ring_run(model_tail);
+    return model_head;
+  }
+  return 0;
+}
+
+void simd_model_report(void) {
+  /* Prints the transactions since the last report and resets the counters */
+  uint64_t insns = 0, bus, device;
+  int i;
+
+  for (i = 0; i < M_NR_OPS; i++)
+    insns += model_stat.ops[i];
+  bus = (model_stat.mmio_writes + model_stat.mmio_reads) *
+        SIMD_MODEL_MMIO_CYCLES;
+  device = insns * SIMD_MODEL_ISSUE_CYCLES +
+           model_stat.macs * SIMD_MODEL_MAC_CYCLES +
+           model_stat.bytes / sizeof(fixedpt) * SIMD_MODEL_WORD_CYCLES;
+
+  printf("simd model:");
+  for (i = 0; i < M_NR_OPS; i++)
+    if (model_stat.ops[i])
+      printf(" %s=%d", model_op_names[i], (int)model_stat.ops[i]);
+  printf("\n");
+  printf("simd model: %d MMIO writes, %d reads, %d bytes moved, %d MACs\n",
+         (int)model_stat.mmio_writes, (int)model_stat.mmio_reads,
+         (int)model_stat.bytes, (int)model_stat.macs);
+  printf("simd model: ring %d doorbells, %d descriptors overlapped with the "
+         "CPU, %d waited for\n",
+         (int)model_stat.doorbells, (int)model_stat.overlapped,
+         (int)model_stat.stalled);
+  printf("simd model: ~%d bus + %d device = %d cycles\n", (int)bus,
+         (int)device, (int)(bus + device));
+
+  memset(&model_stat, 0, sizeof(model_stat));
+}
+#endif
@@ -0,0 +1,119 @@
+#include <gemm.h>
+
+/*
+ * Sparse operands for pruned weight matrices, multiplied by matmul_sparse()
+ * in src/matmul.c. gemm_sparse_from_dense() converts a column-major A in
+ * two passes: one counts the entries of every row, the other fills them in.
+ */
+
+#define min(i, j) ((i) < (j) ? (i) : (j))
+
+static int block_nonzero(int m, int k, fixedpt *a, int lda) {
+  /* Whether the m x k block at a has a nonzero */
+  int i, j;
+
+  for (j = 0; j < k; j++)
+    for (i = 0; i < m; i++)
+      if (A(i, j) != 0)
+        return 1;
+  return 0;
+}
+
+static int sparse_fill(gemm_sparse *sp, fixedpt *a, int lda) {
+  /*
+  Counts (sp->idx == NULL) or stores the entries of A and sets sp->ptr.
+  Returns the number of entries.
+  */
+  int bk = GEMM_SPARSE_BK, r, q, i, j, n = 0, ib, jb;
+  fixedpt *v;
+
+  for (r = 0; r < sp->rows; r++) {
+    sp->ptr[r] = n;
+    if (sp->format == GEMM_SPARSE_CSR) {
+      for (j = 0; j < sp->k; j++)
+        if (A(r, j) != 0) {
+          if (sp->idx) {
+            sp->idx[n] = j;
+            sp->val[n] = A(r, j);
+          }
+          n++;
+        }
+      continue;
+    }
+
+    ib = min(sp->m - r * GEMM_MR, GEMM_MR);
+    for (q = 0; q * bk < sp->k; q++) {
+      jb = min(sp->k - q * bk, bk);
+      if (!block_nonzero(ib, jb, &A(r * GEMM_MR, q * bk), lda))
+        continue;
+      if (sp->idx) { /* PackMatrixA layout, zero padded */
+        sp->idx[n] = q;
+        v = &sp->val[n * GEMM_MR * bk];
+        for (j = 0; j < bk; j++)
+          for (i = 0; i < GEMM_MR; i++)
+            v[j * GEMM_MR + i] =
+                i < ib && j < jb ? A(r * GEMM_MR + i, q * bk + j) : 0;
+      }
+      n++;
+    }
+  }
+  sp->ptr[sp->rows] = n;
+  return n;
+}
+
+gemm_sparse *gemm_sparse_from_dense(int format, int m, int k, fixedpt *a,
+                                    int lda) {
+  /*
+  Keeps the nonzeros of the m x k matrix A, as single elements (CSR) or as
+  GEMM_MR x GEMM_SPARSE_BK blocks (BSR). Free with gemm_sparse_free().
+  */
+  gemm_sparse *sp;
+  int entries, per_entry;
+
+  if (a == NULL || m < 0 || k < 0 ||
+      (format != GEMM_SPARSE_CSR && format != GEMM_SPARSE_BSR)) {
+    printf("Argument Error : Invalid input arguments to "
+           "gemm_sparse_from_dense()\n");
+    return NULL;
+  }
+
+  sp = (gemm_sparse *)malloc(sizeof(gemm_sparse));
+  if (sp == NULL) {
+    printf("Allocation Error : Could not allocate the sparse matrix\n");
+    return NULL;
+  }
+  sp->format = format;
+  sp->m = m;
+  sp->k = k;
+  sp->rows = format == GEMM_SPARSE_CSR ? m : (m + GEMM_MR - 1) / GEMM_MR;
+  sp->idx = NULL;
+  sp->val = NULL;
+  sp->ptr = (int *)malloc((sp->rows + 1) * sizeof(int));
+  if (sp->ptr == NULL) {
+    printf("Allocation Error : Could not allocate the sparse matrix\n");
+    free(sp);
+    return NULL;
+  }
+
+  entries = sparse_fill(sp, a, lda);
+  per_entry = format == GEMM_SPARSE_CSR ? 1 : GEMM_MR * GEMM_SPARSE_BK;
+  sp->idx = (int *)malloc((entries + 1) * sizeof(int));
+  sp->val = (fixedpt *)malloc(((size_t)entries * per_entry + 1) *
+                              sizeof(fixedpt));
+  if (sp->idx == NULL || sp->val == NULL) {
+    printf("Allocation Error : Could not allocate the sparse matrix\n");
+    gemm_sparse_free(sp);
+    return NULL;
+  }
+  sparse_fill(sp, a, lda);
+  return sp;
+}
+
+void gemm_sparse_free(gemm_sparse *sp) {
+  if (sp == NULL)
+    return;
+  free(sp->ptr);
+  free(sp->idx);
+  free(sp->val);
+  free(sp);
+}
@@ -0,0 +1,211 @@
+#include <gemm.h>
+
+/*
+ * Strassen-Winograd matmul for square matrices. Every level splits A, B and
+ * C in quadrants and computes the product with 7 half size products and 15
+ * additions instead of 8 products, which pays off early here: a fixedpt_mul
+ * costs far more than an add. Below the cutoff of gemm_params (strassen=)
+ * the products are done by the blocked matmul(). An odd size is split as
+ * n - 1 plus one peeled row and column, which go to matmul() as well.
+ *
+ * The quadrant sums and products live in one workspace, taken once per
+ * call: 4 h x h temporaries per level of half size h, see
+ * matmul_strassen_query(). The values only differ from matmul() by the
+ * truncation of the fixedpt products, which happens on other sums. The
+ * sums of a level are up to 4 times larger than its operands, so the call
+ * falls back to matmul() when the data does not leave enough headroom for
+ * the products in 64 bits.
+ */
+
+static matmul_workspace *strassen_ws;
+
+static size_t strassen_elems(int n, int cutoff) {
+  /* fixedpt temporaries of all the levels below n */
+  size_t elems = 0;
+
+  for (; n > cutoff && n >= 2; n /= 2)
+    elems += 4 * (size_t)(n / 2) * (n / 2);
+  return elems;
+}
+
+static int strassen_levels(int n, int cutoff) {
+  int levels = 0;
+
+  for (; n > cutoff && n >= 2; n /= 2)
+    levels++;
+  return levels;
+}
+
+static void mat_sum(int n, const fixedpt *x, int ldx, const fixedpt *y,
+                    int ldy, int sign, fixedpt *z) {
+  /* z = x + sign * y, z being n x n with leading dimension n */
+  int i, j;
+
+  for (j = 0; j < n; j++)
+    for (i = 0; i < n; i++)
+      z[j * n + i] = sign > 0 ? x[j * ldx + i] + y[j * ldy + i]
+                              : x[j * ldx + i] - y[j * ldy + i];
+}
+
+static void mat_acc(int n, const fixedpt *x, int ldx, int sign, fixedpt *z,
+                    int ldz) {
+  /* z += sign * x for n x n matrices */
+  int i, j;
+
+  for (j = 0; j < n; j++)
+    for (i = 0; i < n; i++)
+      z[j * ldz + i] += sign > 0 ? x[j * ldx + i] : -x[j * ldx + i];
+}
+
+static uint64_t strassen(int n, fixedpt *a, int lda, fixedpt *b, int ldb,
+                         fixedpt *c, int ldc, fixedpt *tmp, int cutoff) {
+  /*
+  C += A * B, returns the number of fixedpt products. With h = n / 2:
+
+    S1 = A21 + A22   S2 = S1 - A11    S3 = A11 - A21   S4 = A12 - S2
+    T1 = B12 - B11   T2 = B22 - T1    T3 = B22 - B12   T4 = T2 - B21
+
+    P1 = A11 B11  P2 = A12 B21  P3 = S4 B22  P4 = A22 T4
+    P5 = S1 T1    P6 = S2 T2    P7 = S3 T3
+
+    C11 += P1 + P2             C12 += P1 + P6 + P5 + P3
+    C21 += P1 + P6 + P7 - P4   C22 += P1 + P6 + P7 + P5
+
+  The partial sum U of P1, P6 and P7 is shared by the last three.
+  */
+  int h = n / 2, hh = h * h;
+  fixedpt *S = tmp, *T = S + hh, *P = T + hh, *U = P + hh, *next = U + hh;
+  fixedpt *a11 = a, *a21 = &A(h, 0), *a12 = &A(0, h), *a22 = &A(h, h);
+  fixedpt *b11 = b, *b21 = &B(h, 0), *b12 = &B(0, h), *b22 = &B(h, h);
+  fixedpt *c11 = c, *c21 = &C(h, 0), *c12 = &C(0, h), *c22 = &C(h, h);
+  uint64_t muls = 0;
+
+  if (n <= cutoff || n < 2) {
+    matmul(n, n, n, a, lda, b, ldb, c, ldc);
+    return (uint64_t)n * n * n;
+  }
+
+#define PRODUCT(x, ldx, y, ldy)                                                \
+  do {                                                                         \
+    memset(P, 0, hh * sizeof(fixedpt));                                        \
+    muls += strassen(h, x, ldx, y, ldy, P, h, next, cutoff);                   \
+  } while (0)
+
+  PRODUCT(a11, lda, b11, ldb); /* P1 */
+  mat_acc(h, P, h, 1, c11, ldc);
+  memcpy(U, P, hh * sizeof(fixedpt));
+  PRODUCT(a12, lda, b21, ldb); /* P2 */
+  mat_acc(h, P, h, 1, c11, ldc);
+
+  mat_sum(h, a21, lda, a22, lda, 1, S); /* S1 */
+  mat_sum(h, b12, ldb, b11, ldb, -1, T); /* T1 */
+  PRODUCT(S, h, T, h);                   /* P5 */
+  mat_acc(h, P, h, 1, c12, ldc);
+  mat_acc(h, P, h, 1, c22, ldc);
+
+  mat_acc(h, a11, lda, -1, S, h); /* S2 = S1 - A11 */
+  mat_sum(h, b22, ldb, T, h, -1, T); /* T2 = B22 - T1 */
+  PRODUCT(S, h, T, h);               /* P6 */
+  mat_acc(h, P, h, 1, U, h);
+  mat_acc(h, U, h, 1, c12, ldc);
+
+  mat_sum(h, a12, lda, S, h, -1, S); /* S4 = A12 - S2 */
+  PRODUCT(S, h, b22, ldb);           /* P3 */
+  mat_acc(h, P, h, 1, c12, ldc);
+
+  mat_acc(h, b21, ldb, -1, T, h); /* T4 = T2 - B21 */
+  PRODUCT(a22, lda, T, h);   /* P4 */
+  mat_acc(h, P, h, -1, c21, ldc);
+
+  mat_sum(h, a11, lda, a21, lda, -1, S); /* S3 */
+  mat_sum(h, b22, ldb, b12, ldb, -1, T); /* T3 */
+  PRODUCT(S, h, T, h);                   /* P7 */
+  mat_acc(h, P, h, 1, U, h);
+  mat_acc(h, U, h, 1, c21, ldc);
+  mat_acc(h, U, h, 1, c22, ldc);
+#undef PRODUCT
+
+  if (n % 2) { /* the peeled last row and column of C */
+    matmul(2 * h, 2 * h, 1, &A(0, 2 * h), lda, &B(2 * h, 0), ldb, c, ldc);
+    matmul(n, 1, n, a, lda, &B(0, 2 * h), ldb, &C(0, 2 * h), ldc);
+    matmul(1, 2 * h, n, &A(2 * h, 0), lda, b, ldb, &C(2 * h, 0), ldc);
+    muls += (uint64_t)4 * hh + (uint64_t)n * n + (uint64_t)2 * h * n;
+  }
+  return muls;
+}
+
+static int bits(uint64_t v) {
+  int r = 0;
+
+  for (; v; v >>= 1)
+    r++;
+  return r;
+}
+
+static int max_bits(const fixedpt *x, int n, int ldx) {
+  /* Bits of the largest magnitude in an n x n matrix */
+  uint64_t max = 0, v;
+  int i, j;
+
+  for (j = 0; j < n; j++)
+    for (i = 0; i < n; i++) {
+      v = x[j * ldx + i] < 0 ? -(uint64_t)x[j * ldx + i] : x[j * ldx + i];
+      max = v > max ? v : max;
+    }
+  return bits(max);
+}
+
+size_t matmul_strassen_query(int n) {
+  /* Workspace bytes matmul_strassen() needs for n x n matrices */
+  gemm_params params;
+
+  gemm_get_params(&params);
+  return strassen_elems(n, params.strassen) * sizeof(fixedpt);
+}
+
+uint64_t matmul_strassen(int n, fixedpt *a, int lda, fixedpt *b, int ldb,
+                         fixedpt *c, int ldc, matmul_workspace *ws) {
+  /*
+  C = A * B + C for n x n matrices, by Strassen-Winograd down to the
+  cutoff of gemm_params. The temporaries are taken from ws, or from a
+  workspace kept for later calls when ws is NULL.
+
+  Returns the number of fixedpt products, n^3 for matmul(), so the saving
+  is n^3 minus that; 0 on error.
+  */
+  gemm_params params;
+  fixedpt *tmp;
+  int levels;
+
+  if (a == NULL || b == NULL || c == NULL || n < 0) {
+    printf("Argument Error : Invalid input arguments to matmul_strassen()\n");
+    return 0;
+  }
+
+  gemm_get_params(&params);
+  levels = strassen_levels(n, params.strassen);
+  /*
+  Quadrant sums grow 4 times per level, the products add the bits of both
+  operands and of n, minus the fraction bits, and U sums 3 of them.
+  */
+  if (levels == 0 || max_bits(a, n, lda) + max_bits(b, n, ldb) +
+                             4 * levels + bits(n) + 2 - FIXEDPT_FBITS >=
+                         63) {
+    matmul(n, n, n, a, lda, b, ldb, c, ldc);
+    return (uint64_t)n * n * n;
+  }
+
+  if (ws == NULL && strassen_ws == NULL)
+    strassen_ws = matmul_workspace_create(0);
+  if (ws == NULL)
+    ws = strassen_ws;
+  if (ws == NULL || !matmul_workspace_reserve(ws, matmul_strassen_query(n))) {
+    printf("Allocation Error : Could not grow the matmul_strassen() "
+           "workspace\n");
+    return 0;
+  }
+  matmul_workspace_reset(ws);
+  tmp = (fixedpt *)matmul_workspace_alloc(ws, matmul_strassen_query(n));
+
+  return strassen(n, a, lda, b, ldb, c, ldc, tmp, params.strassen);
+}
@@ -0,0 +1,115 @@
+#include <gemm.h>
+
+/*
+ * A small fork-join pool on top of the abstract-machine multiprocessor
+ * extension (MPE). gemm_threads_start() boots every CPU: CPU 0 runs the
+ * application and the others wait for work, which gemm_parallel() hands
+ * out. Without MPE, or before the pool is started, everything runs on the
+ * calling CPU. On native builds AM emulates the CPUs on the host.
+ *
+ * AM only provides atomic_xchg, so the lock and barrier are spin based.
+ */
+
+#define min(i, j) ((i) < (j) ? (i) : (j))
+
+static void (*app_entry)(void);
+static volatile int started = 0, nthreads = 1;
+
+static void (*volatile job_fn)(int, int, void *);
+static void *volatile job_arg;
+static volatile int job_gen = 0, job_done = 0, job_nthreads = 1;
+
+static int lock = 0;
+static volatile int bar_count = 0, bar_sense = 0;
+
+static void spin_lock(int *l) {
+  while (atomic_xchg(l, 1))
+    ;
+}
+
+static void spin_unlock(int *l) { atomic_xchg(l, 0); }
+
+static void worker(void) {
+  int seen = 0, tid = cpu_current();
+
+  while (1) {
+    while (job_gen == seen)
+      ;
+    seen = job_gen;
+    if (tid < job_nthreads) {
+      job_fn(tid, job_nthreads, job_arg);
+      spin_lock(&lock);
+      job_done++;
+      spin_unlock(&lock);
+    }
+  }
+}
+
+static void mpe_entry(void) {
+  if (cpu_current() != 0)
+    worker();
+
+  nthreads = min(cpu_count(), GEMM_MAX_THREADS);
+  started = 1;
+  app_entry();
+  halt(0);
+}
+
+void gemm_threads_start(void (*app)(void)) {
+  /* Does not return when MPE is available: the app's end halts the machine */
+  app_entry = app;
+  mpe_init(mpe_entry);
+  app();
+}
+
+int gemm_threads(void) { return started ? nthreads : 1; }
+
+void gemm_set_threads(int n) {
+  if (!started)
+    return;
+  nthreads = n < 1 ? 1 : min(n, min(cpu_count(), GEMM_MAX_THREADS));
+}
+
+void gemm_parallel(void (*fn)(int, int, void *), void *arg) {
+  /*
+  Runs fn(tid, nthreads, arg) on gemm_threads() CPUs, the caller being
+  tid 0, and returns once all of them are done.
+  */
+  int n = gemm_threads();
+
+  if (n <= 1) {
+    fn(0, 1, arg);
+    return;
+  }
+
+  job_fn = fn;
+  job_arg = arg;
+  job_nthreads = n;
+  job_done = 0;
+  spin_lock(&lock);
+  job_gen++;
+  spin_unlock(&lock);
+
+  fn(0, n, arg);
+  while (job_done != n - 1)
+    ;
+}
+
+void gemm_barrier(void) {
+  /* Sense-reversing barrier between the threads of one gemm_parallel() */
+  int sense = bar_sense;
+
+  if (job_nthreads <= 1 || gemm_threads() <= 1)
+    return;
+
+  spin_lock(&lock);
+  if (++bar_count == job_nthreads) {
+    bar_count = 0;
+    bar_sense = !sense;
+    spin_unlock(&lock);
+    return;
+  }
+  spin_unlock(&lock);
+  while (bar_sense == sense)
+    ;
+}
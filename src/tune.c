@@ -0,0 +1,199 @@
+#include <gemm.h>
+
+/*
+ * Block size tuning. gemm_tune() times matmul() on the current machine and
+ * returns the fastest parameters, which src/autotune.c prints as a profile
+ * string for include/gemm_profile.h, e.g.
+ *
+ *   #define GEMM_PROFILE \
+ *     "mc=64 kc=64 nc=256 kernel=vregs strassen=64 direct=8 gemv=256"
+ *
+ * matmul() loads the profile at its first call and gemm_parse_params()
+ * reads the same format, e.g. from mainargs.
+ */
+
+#define TUNE_REPS 2
+
+static const int tune_mc[] = {32, 64, 128, 256};
+static const int tune_kc[] = {32, 64, 128, 256};
+static const int tune_nc[] = {64, 256, 1000};
+static const int tune_strassen[] = {32, 64, 128, 256, 512};
+static const int tune_direct[] = {0, 4, 8, 16, 32, 64};
+static const int tune_gemv[] = {64, 128, 256, 512, 1024};
+
+/* What time_params() times */
+#define TUNE_MATMUL 0
+#define TUNE_STRASSEN 1
+#define TUNE_SMALL 2
+
+/*
+ * Shapes timed for the direct= and gemv= thresholds: squares up to 64, the
+ * matrix times vector and vector times matrix products of the tuning size,
+ * and a matrix times vector product TUNE_GEMV_K deep with as many values,
+ * whose long columns are what gemv= splits. Every one is repeated
+ * TUNE_SMALL_REPS times to rise above the timer resolution.
+ */
+static const int tune_small[] = {4, 8, 12, 16, 24, 32, 48, 64};
+#define TUNE_SMALL_REPS 8
+#define TUNE_GEMV_K 16
+
+int gemm_parse_params(const char *profile, gemm_params *p) {
+  /*
+  Updates p from a space separated list of mc=, kc=, nc=, kernel=,
+  strassen=, direct= and gemv=, keys that are not given keep their value.
+  kernel=auto lets matmul() pick.
+  Returns 0 when the kernel is not one of gemm_kernel_name().
+  */
+  while (profile != NULL && *profile != '\0') {
+    while (*profile == ' ')
+      profile++;
+    const char *eq = strchr(profile, '=');
+    if (eq == NULL)
+      break;
+    const char *end = strchr(eq, ' ');
+    int len = end ? end - (eq + 1) : strlen(eq + 1);
+
+    if (strncmp(profile, "mc=", 3) == 0)
+      p->mc = atoi(eq + 1);
+    else if (strncmp(profile, "kc=", 3) == 0)
+      p->kc = atoi(eq + 1);
+    else if (strncmp(profile, "nc=", 3) == 0)
+      p->nc = atoi(eq + 1);
+    else if (strncmp(profile, "strassen=", 9) == 0)
+      p->strassen = atoi(eq + 1);
+    else if (strncmp(profile, "direct=", 7) == 0)
+      p->direct = atoi(eq + 1);
+    else if (strncmp(profile, "gemv=", 5) == 0)
+      p->gemv = atoi(eq + 1);
+    else if (strncmp(profile, "kernel=", 7) == 0) {
+      const char *name;
+      int i;
+
+      p->kernel = NULL;
+      if (len == 4 && strncmp(eq + 1, "auto", 4) == 0)
+        ;
+      else {
+        for (i = 0; (name = gemm_kernel_name(i)) != NULL; i++)
+          if ((int)strlen(name) == len && strncmp(eq + 1, name, len) == 0)
+            break;
+        if (name == NULL)
+          return 0;
+        p->kernel = name;
+      }
+    }
+
+    profile = end;
+  }
+  return 1;
+}
+
+static void small_shapes(int size, fixedpt *a, fixedpt *b, fixedpt *c) {
+  /* The shapes of tune_small, TUNE_SMALL_REPS times each */
+  int tall = size * size / TUNE_GEMV_K;
+
+  for (int r = 0; r < TUNE_SMALL_REPS; r++) {
+    for (int i = 0; i < (int)LENGTH(tune_small) && tune_small[i] <= size; i++)
+      matmul(tune_small[i], tune_small[i], tune_small[i], a, size, b, size, c,
+             size);
+    matmul(size, 1, size, a, size, b, size, c, size);
+    matmul(1, size, size, a, size, b, size, c, size);
+    if (tall > 0)
+      matmul(tall, 1, TUNE_GEMV_K, a, tall, b, TUNE_GEMV_K, c, tall);
+  }
+}
+
+static uint64_t time_params(const gemm_params *p, int mode, int size,
+                            fixedpt *a, fixedpt *b, fixedpt *c) {
+  /* Times matmul(), matmul_strassen() or the small shapes, see mode */
+  uint64_t best = 0;
+
+  gemm_set_params(p);
+  for (int r = 0; r < TUNE_REPS; r++) {
+    memset(c, 0, (size_t)size * size * sizeof(fixedpt));
+    uint64_t start = io_read(AM_TIMER_UPTIME).us;
+    if (mode == TUNE_STRASSEN)
+      matmul_strassen(size, a, size, b, size, c, size, NULL);
+    else if (mode == TUNE_SMALL)
+      small_shapes(size, a, b, c);
+    else
+      matmul(size, size, size, a, size, b, size, c, size);
+    uint64_t us = io_read(AM_TIMER_UPTIME).us - start;
+    if (r == 0 || us < best)
+      best = us;
+  }
+  return best;
+}
+
+#define TRY(field, values)                                                     \
+  for (i = 0; i < (int)LENGTH(values); i++) {                                  \
+    trial = *best;                                                             \
+    trial.field = values[i];                                                   \
+    us = time_params(&trial, mode, size, a, b, c);                             \
+    if (us < best_us) {                                                        \
+      best_us = us;                                                            \
+      *best = trial;                                                           \
+    }                                                                          \
+  }
+
+void gemm_tune(int size, gemm_params *best) {
+  /*
+  Times a size x size x size matmul() for every tile kernel and then walks
+  the mc, kc and nc grids above one at a time, keeping the other parameters
+  at the fastest values found so far. This is a few dozen runs instead of
+  the whole grid, so that tuning takes seconds even on small cores. The
+  Strassen cutoff is then timed on matmul_strassen() with those blocks, and
+  the direct= and gemv= thresholds on the small shapes above when the
+  kernel is left to matmul(). The parameters matmul() used before are
+  restored.
+  */
+  gemm_params saved, trial;
+  const char *names[8];
+  uint64_t best_us, us;
+  int i, mode = TUNE_MATMUL;
+
+  gemm_get_params(&saved);
+  *best = (gemm_params){GEMM_DEFAULT_MC,       GEMM_DEFAULT_KC,
+                        GEMM_DEFAULT_NC,       NULL,
+                        GEMM_DEFAULT_STRASSEN, GEMM_DEFAULT_DIRECT,
+                        GEMM_DEFAULT_GEMV};
+
+  fixedpt *a = (fixedpt *)malloc((size_t)size * size * sizeof(fixedpt));
+  fixedpt *b = (fixedpt *)malloc((size_t)size * size * sizeof(fixedpt));
+  fixedpt *c = (fixedpt *)malloc((size_t)size * size * sizeof(fixedpt));
+  if (a == NULL || b == NULL || c == NULL) {
+    printf("Allocation Error : gemm_tune() matrices do not fit in the heap\n");
+    free(a);
+    free(b);
+    free(c);
+    return;
+  }
+  random_init_notype(size, size, a, size);
+  random_init_notype(size, size, b, size);
+
+  for (i = 0; i < (int)LENGTH(names); i++)
+    names[i] = gemm_kernel_name(i);
+
+  /* names ends in NULLs, which is the automatic kernel again */
+  best_us = time_params(best, mode, size, a, b, c);
+  TRY(kernel, names);
+  TRY(mc, tune_mc);
+  TRY(kc, tune_kc);
+  TRY(nc, tune_nc);
+
+  mode = TUNE_STRASSEN;
+  best_us = time_params(best, mode, size, a, b, c);
+  TRY(strassen, tune_strassen);
+
+  /* A forced kernel always packs, so direct= and gemv= would do nothing */
+  if (best->kernel == NULL) {
+    mode = TUNE_SMALL;
+    best_us = time_params(best, mode, size, a, b, c);
+    TRY(direct, tune_direct);
+    TRY(gemv, tune_gemv);
+  }
+
+  gemm_set_params(&saved);
+  free(a);
+  free(b);
+  free(c);
+}
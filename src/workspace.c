@@ -0,0 +1,75 @@
+#include <gemm.h>
+
+/*
+ * A matmul_workspace is a small arena that hands out cache-line aligned
+ * chunks (the packed A and B panels). The backing buffer is only reallocated
+ * when a call needs more room than any previous one, so repeated calls to
+ * matmul do not touch the allocator at all.
+ */
+
+matmul_workspace *matmul_workspace_create(size_t bytes) {
+  matmul_workspace *ws = (matmul_workspace *)malloc(sizeof(matmul_workspace));
+  if (ws == NULL)
+    return NULL;
+
+  ws->raw = NULL;
+  ws->base = NULL;
+  ws->size = 0;
+  ws->used = 0;
+  ws->peak = 0;
+
+  if (bytes > 0 && !matmul_workspace_reserve(ws, bytes)) {
+    free(ws);
+    return NULL;
+  }
+  return ws;
+}
+
+void matmul_workspace_destroy(matmul_workspace *ws) {
+  if (ws == NULL)
+    return;
+  free(ws->raw);
+  free(ws);
+}
+
+int matmul_workspace_reserve(matmul_workspace *ws, size_t bytes) {
+  /*
+  Makes sure at least `bytes` bytes can be handed out by the arena. Any
+  chunk handed out before a growing reserve is invalidated, so callers
+  reserve once up front and then allocate.
+
+  Return
+  ------
+          1 on success, 0 if the allocation failed
+  */
+  bytes = ROUNDUP(bytes, GEMM_CACHE_LINE);
+  if (bytes <= ws->size)
+    return 1;
+
+  void *raw = malloc(bytes + GEMM_CACHE_LINE - 1);
+  if (raw == NULL)
+    return 0;
+
+  free(ws->raw);
+  ws->raw = raw;
+  ws->base = (char *)ROUNDUP(raw, GEMM_CACHE_LINE);
+  ws->size = bytes;
+  ws->used = 0;
+  return 1;
+}
+
+void matmul_workspace_reset(matmul_workspace *ws) { ws->used = 0; }
+
+void *matmul_workspace_alloc(matmul_workspace *ws, size_t bytes) {
+  bytes = ROUNDUP(bytes, GEMM_CACHE_LINE);
+  if (ws->used + bytes > ws->size)
+    return NULL;
+
+  void *chunk = ws->base + ws->used;
+  ws->used += bytes;
+  if (ws->used > ws->peak)
+    ws->peak = ws->used;
+  return chunk;
+}
+
+size_t matmul_workspace_peak(const matmul_workspace *ws) { return ws->peak; }